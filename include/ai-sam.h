@@ -15,16 +15,11 @@
 #include "fujinet-fuji.h"
 #include "fujinet-clock.h"
 
-// Buffer Sizes
-#ifdef _CMOC_VERSION_
-#define RESPONSE_BUFFER_SIZE 2048
-#define REQUEST_BUFFER_SIZE 1536
-#else
-#define RESPONSE_BUFFER_SIZE 3072
-#define REQUEST_BUFFER_SIZE 2048
-#endif
+// Buffer sizes and arena layout
+#include "arena.h"
+#include "json.h"
+#include "fmt.h"
 #define SAM_CHUNK_SIZE 100
-#define MAX_TEXT_SIZE 960
 
 #ifdef BUILD_MSDOS
 extern int screen_width;
@@ -37,40 +32,59 @@ void msdos_init_screen(void);
 #define SCREEN_HEIGHT 20
 #endif
 
+// Platform name sent to the server with the other capabilities
+#if defined(BUILD_ATARI)
+#define PLATFORM_NAME "atari"
+#elif defined(_CMOC_VERSION_)
+#define PLATFORM_NAME "coco"
+#elif defined(BUILD_MSDOS)
+#define PLATFORM_NAME "msdos"
+#elif defined(BUILD_C64)
+#define PLATFORM_NAME "c64"
+#elif defined(BUILD_APPLE2)
+#define PLATFORM_NAME "apple2"
+#else
+#define PLATFORM_NAME "other"
+#endif
+
 // App Key Details
 #define CREATOR_ID 0x3022
 #define APP_ID 0x01
 #define TOKEN_KEY_ID 0x01
+#define PENDING_KEY_ID 0x02  // message_id of an unanswered question
+#define RUN_KEY_ID 0x03      // run count, part of each idempotency key
 
 // Async polling
 #define CHECK_INTERVAL 6      // seconds between polls
 #define CHECK_TIMEOUT 90      // total timeout in seconds
+#define CHECK_HOLD 5          // seconds the server may hold a poll (long poll),
+                              // also how long a key press may take to cancel
+#define RESUME_TIMEOUT 300    // RESUME keeps polling this long
+#define SUBMIT_WAIT "5"       // seconds the submit may wait for a quick answer
 
 // Endpoint URLs (relative to PROXY_API_URL in config.h)
 #define SUBMIT_URL "submit_request.php"
 #define CHECK_URL  "check_request.php"
+#define CANCEL_URL "cancel_request.php"
 
-// Global buffers
-extern char response_buffer[];
-extern char devicespec[];
-extern char json_payload[];
-extern char user_input[];
-extern char escaped_input[];
-extern char text_display[];
-#ifdef BUILD_ATARI
-extern char text_sam[];
-#endif
+// Global buffers, all inside the arena (see arena.h)
+extern char arena[];
+#define DEVICESPEC      (arena)
+#define USER_INPUT      (arena + DEVICESPEC_SIZE)
+#define JSON_PAYLOAD    (arena + ARENA_SHARED_OFS)
+#define RESPONSE_BUFFER (arena + ARENA_SHARED_OFS)
+#define TEXT_DISPLAY    (RESPONSE_BUFFER + RESPONSE_BUFFER_SIZE)
 extern bool speak;
 extern char message_id[];
 extern char status[];
 
 // Function prototypes
 bool init_fujinet(void);
-bool send_openai_request(char *user_input);
-void process_response(const char *text_display, const char *text_sam);
+void arena_enter(uint8_t phase);
+bool send_openai_request(char *question);
+void process_response(char *text);
 void display_text(char *text);
 void speak_text(const char *sam_text);
-void escape_json_string(const char *input, char *output, int output_size);
 void get_user_input(char *buffer, int max_length);
 void print_help(void);
 void process_text(char *text);
@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Buffer arena
+//
+// The client's large buffers are never all live at the same time, so they
+// are carved out of one static arena instead of separate globals. A turn
+// moves through these phases:
+//
+//   PHASE_INPUT    USER_INPUT
+//   PHASE_REQUEST  USER_INPUT, JSON_PAYLOAD, DEVICESPEC
+//   PHASE_POLL     RESPONSE_BUFFER, DEVICESPEC
+//   PHASE_RENDER   TEXT_DISPLAY, DEVICESPEC (speech reads the open channel)
+//
+// DEVICESPEC and USER_INPUT keep their own space: DEVICESPEC is used in
+// every phase, and USER_INPUT must survive new_convo() (which uses
+// RESPONSE_BUFFER) when a request is retried with a renewed token. The
+// request buffer and the reply buffers overlap in the rest of the arena.
+//
+// This header has no other includes so tools/arena-report.c can use it on
+// the build host.
+
+// Buffer sizes per platform
+#ifdef _CMOC_VERSION_
+#define RESPONSE_BUFFER_SIZE 2048
+#define REQUEST_BUFFER_SIZE 1536
+#else
+#define RESPONSE_BUFFER_SIZE 3072
+#define REQUEST_BUFFER_SIZE 2048
+#endif
+#define MAX_TEXT_SIZE 960
+#define DEVICESPEC_SIZE 256
+#define USER_INPUT_SIZE 512
+
+#define ARENA_REQUEST_SIZE (REQUEST_BUFFER_SIZE)
+#define ARENA_REPLY_SIZE   (RESPONSE_BUFFER_SIZE + MAX_TEXT_SIZE)
+#define ARENA_SHARED_SIZE  (ARENA_REQUEST_SIZE > ARENA_REPLY_SIZE ? ARENA_REQUEST_SIZE : ARENA_REPLY_SIZE)
+#define ARENA_SIZE         (DEVICESPEC_SIZE + USER_INPUT_SIZE + ARENA_SHARED_SIZE)
+
+// What the same buffers would take as separate globals
+#define ARENA_UNSHARED_SIZE (DEVICESPEC_SIZE + USER_INPUT_SIZE + ARENA_REQUEST_SIZE + ARENA_REPLY_SIZE)
+
+#define ARENA_SHARED_OFS   (DEVICESPEC_SIZE + USER_INPUT_SIZE)
+
+enum arena_phase
+{
+    PHASE_INPUT,
+    PHASE_REQUEST,
+    PHASE_POLL,
+    PHASE_RENDER
+};
+
+#endif // ARENA_H
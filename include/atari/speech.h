@@ -3,6 +3,12 @@
 
 #define NEWLINE 0x9B
 
+bool speech_open(void);
+void speech_close(void);
 void speak_text(const char *sam_text);
+void speech_begin_reply(void);
+void speech_begin_replay(const char *sam);
+bool speech_pump(void);
+void speech_end_reply(void);
 
-#endif /* SPEECH_H */
\ No newline at end of file
+#endif /* SPEECH_H */
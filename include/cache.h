@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reply cache for the BACK and REPLAY commands
+//
+// The last CACHE_REPLIES replies are kept in extended memory, the text as
+// it was displayed plus the SAM chunks, so earlier answers can be shown and
+// spoken again without a round trip. Only the Atari 130XE banks are used
+// (src/atari/cache.c); on an Atari without them the cache stays empty.
+// Other platforms have no reply cache, and BACK and REPLAY are left out.
+#ifdef BUILD_ATARI
+#define REPLY_CACHE
+#define CACHE_REPLIES 16
+
+bool cache_init(void);
+bool cache_available(void);
+void cache_begin(const char *text);
+void cache_add_sam(const char *chunk);
+void cache_end(void);
+uint8_t cache_count(void);
+bool cache_fetch(uint8_t back, char *text, char *sam, uint16_t sam_size);
+#else
+#define cache_begin(text) ((void)(text))
+#define cache_end()
+#endif
+
+#endif // CACHE_H
@@ -6,6 +6,7 @@
 
 void clear_screen(byte color);
 char cgetc(void);
+bool kbhit(void);
 int wherex(void);
 int wherey(void);
 void gotoxy(int x, int y);
@@ -15,6 +16,9 @@ void hirestxt_close(void);
 void switch_colorset(void);
 #define clrscr() clear_screen(1);
 
+// PMODE 4 buffer of the hires text screen (hirestxt_init())
+#define SCREEN_BUFFER (byte*) 0xA00
+
 #define ARROW_UP 0x5E
 #define ARROW_DOWN 0x0A
 #define ARROW_LEFT 0x08
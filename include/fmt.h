@@ -0,0 +1,31 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+// Small formatted output layer. It only knows what AI SAM needs (%s, %d,
+// %u and %%), which keeps the printf family out of the binary on cc65,
+// CMOC and z88dk.
+void out_str(const char *s);
+void out_fmt(const char *fmt, ...);
+uint16_t str_fmt(char *buf, uint16_t size, const char *fmt, ...);
+
+// Single character output. MS-DOS writes straight to video memory
+// (src/msdos/conio.c) and out_flush() moves the hardware cursor there.
+#ifdef BUILD_MSDOS
+void con_putc(char c);
+void con_write(const char *s, uint16_t len);
+void con_sync(void);
+#define out_char(c) con_putc(c)
+#define out_flush() con_sync()
+#else
+#define out_char(c) putchar(c)
+#define out_flush()
+#endif
+
+// Build "N1:<PROXY_API_URL><endpoint>" in DEVICESPEC and add query parameters
+void url_build(const char *endpoint);
+void url_add_param(const char *name, const char *value);
+
+#endif // FMT_H
@@ -0,0 +1,24 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Streaming writer for small JSON request objects. Values are escaped
+// straight into the payload buffer. If the buffer runs out, the current
+// string and the object are still closed so the payload stays valid JSON,
+// and json_end() reports the truncation.
+typedef struct
+{
+    char *buf;
+    uint16_t size;
+    uint16_t len;
+    bool first;
+    bool truncated;
+} json_writer;
+
+void json_begin(json_writer *w, char *buf, uint16_t size);
+void json_add_string(json_writer *w, const char *key, const char *value);
+bool json_end(json_writer *w);
+
+#endif // JSON_H
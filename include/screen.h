@@ -0,0 +1,40 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reply renderer used by display_text()
+//
+// Platforms with a direct renderer (src/<platform>/screen.c) write words
+// straight into screen memory, wrap and scroll with block moves and only
+// hand the cursor back to the OS in scr_end(). Everything else prints
+// through putchar() (src/screen.c).
+//
+// Platforms that define SCREEN_PAGED draw a page that fills the screen on a
+// cleared screen instead of scrolling it in: scr_page() gets the length of
+// the text still to come and returns true if it cleared the screen.
+//
+// Output must stay between scr_begin() and scr_end(); anything else that
+// prints (prompts, out_str()) goes outside such a block.
+#if defined(BUILD_ATARI) || defined(BUILD_C64) || defined(BUILD_MSDOS)
+#define SCREEN_DIRECT
+#endif
+
+#ifdef _CMOC_VERSION_
+#define SCREEN_DIRECT
+#define SCREEN_PAGED
+#endif
+
+void scr_begin(void);
+void scr_write(const char *s, uint16_t len);
+void scr_newline(void);
+void scr_end(void);
+
+#ifdef SCREEN_PAGED
+bool scr_page(uint16_t remaining);
+#else
+#define scr_page(remaining) false
+#endif
+
+#endif // SCREEN_H
@@ -0,0 +1,47 @@
+--
+-- SQLite schema for the `ai-sam` database ($dbDriver = "sqlite").
+-- Same tables and columns as ai-sam-db.sql. storage.php creates it when
+-- the database file does not exist yet.
+--
+-- Times are UTC text 'YYYY-MM-DD HH:MM:SS.fff', which sorts like the
+-- MySQL datetime(6) columns but only to the millisecond (strftime('%f')).
+--
+
+CREATE TABLE IF NOT EXISTS messages (
+  id INTEGER PRIMARY KEY AUTOINCREMENT,
+  token_id TEXT NOT NULL,
+  role TEXT NOT NULL CHECK (role IN ('user', 'assistant')),
+  content TEXT NOT NULL,
+  created_at TEXT NOT NULL DEFAULT (strftime('%Y-%m-%d %H:%M:%f', 'now')),
+  status INTEGER NOT NULL DEFAULT 0,
+  idem_key TEXT DEFAULT NULL,
+  sched_tag REAL DEFAULT NULL,
+  started_at TEXT DEFAULT NULL,
+  caps TEXT DEFAULT NULL
+);
+
+-- Tokens are only ever looked up by key
+CREATE TABLE IF NOT EXISTS tokens (
+  token_id TEXT NOT NULL PRIMARY KEY,
+  created_at TEXT NOT NULL DEFAULT (strftime('%Y-%m-%d %H:%M:%f', 'now')),
+  last_activity_at TEXT NOT NULL DEFAULT (strftime('%Y-%m-%d %H:%M:%f', 'now')),
+  weight INTEGER NOT NULL DEFAULT 1,
+  vfinish REAL NOT NULL DEFAULT 0
+) WITHOUT ROWID;
+
+-- Signed tokens revoked by NEW, kept until they would have expired
+CREATE TABLE IF NOT EXISTS revoked_tokens (
+  token_id TEXT NOT NULL PRIMARY KEY,
+  revoked_at TEXT NOT NULL DEFAULT (strftime('%Y-%m-%d %H:%M:%f', 'now'))
+) WITHOUT ROWID;
+
+--
+-- Indexes. The scheduler only looks at unanswered turns (status = 1), so
+-- its indexes are partial and stay as small as the queue.
+--
+CREATE INDEX IF NOT EXISTS idx_token_created ON messages (token_id, created_at, id);
+CREATE UNIQUE INDEX IF NOT EXISTS idx_token_idem ON messages (token_id, idem_key) WHERE idem_key IS NOT NULL;
+CREATE INDEX IF NOT EXISTS idx_queue ON messages (sched_tag, id) WHERE status = 1 AND started_at IS NULL;
+CREATE INDEX IF NOT EXISTS idx_running ON messages (started_at) WHERE status = 1 AND started_at IS NOT NULL;
+CREATE INDEX IF NOT EXISTS idx_last_activity ON tokens (last_activity_at);
+CREATE INDEX IF NOT EXISTS idx_revoked_at ON revoked_tokens (revoked_at);
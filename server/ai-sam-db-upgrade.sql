@@ -0,0 +1,58 @@
+--
+-- Upgrade an existing `ai-sam` database to the current schema.
+-- New installs should import ai-sam-db.sql instead.
+-- Run the sections added since your last upgrade, in order.
+--
+
+--
+-- Token activity column used by the batched cleanup
+--
+ALTER TABLE `tokens`
+  ADD `last_activity_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6) AFTER `created_at`,
+  ADD KEY `idx_last_activity` (`last_activity_at`);
+
+UPDATE `tokens` AS t
+  LEFT JOIN (
+      SELECT token_id, MAX(created_at) AS last_msg_at
+        FROM messages
+    GROUP BY token_id
+  ) AS lm ON lm.token_id = t.token_id
+   SET t.last_activity_at = COALESCE(lm.last_msg_at, t.created_at);
+
+--
+-- Idempotency key for retried submissions
+--
+ALTER TABLE `messages`
+  ADD `idem_key` varchar(32) COLLATE utf8mb4_unicode_ci DEFAULT NULL AFTER `status`,
+  ADD UNIQUE KEY `idx_token_idem` (`token_id`,`idem_key`);
+
+--
+-- Request queue and fair queueing state
+--
+ALTER TABLE `messages`
+  ADD `sched_tag` double DEFAULT NULL AFTER `idem_key`,
+  ADD `started_at` datetime(6) DEFAULT NULL AFTER `sched_tag`,
+  ADD KEY `idx_queue` (`status`,`started_at`,`sched_tag`);
+
+ALTER TABLE `tokens`
+  ADD `weight` smallint UNSIGNED NOT NULL DEFAULT 1 AFTER `last_activity_at`,
+  ADD `vfinish` double NOT NULL DEFAULT 0 AFTER `weight`;
+
+-- Rows still pending from before the upgrade count as already started
+UPDATE `messages` SET `started_at` = `created_at` WHERE `status` = 1;
+
+--
+-- Client capabilities (screen, reply size, speech) stored with each turn
+--
+ALTER TABLE `messages`
+  ADD `caps` varchar(255) COLLATE utf8mb4_unicode_ci DEFAULT NULL AFTER `started_at`;
+
+--
+-- Signed tokens revoked by NEW, kept until they would have expired
+--
+CREATE TABLE `revoked_tokens` (
+  `token_id` char(32) COLLATE utf8mb4_unicode_ci NOT NULL,
+  `revoked_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6),
+  PRIMARY KEY (`token_id`),
+  KEY `idx_revoked_at` (`revoked_at`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
@@ -25,7 +25,11 @@ CREATE TABLE `messages` (
   `role` enum('user','assistant') COLLATE utf8mb4_unicode_ci NOT NULL,
   `content` text COLLATE utf8mb4_unicode_ci NOT NULL,
   `created_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6),
-  `status` tinyint NOT NULL DEFAULT 0
+  `status` tinyint NOT NULL DEFAULT 0,
+  `idem_key` varchar(32) COLLATE utf8mb4_unicode_ci DEFAULT NULL,
+  `sched_tag` double DEFAULT NULL,
+  `started_at` datetime(6) DEFAULT NULL,
+  `caps` varchar(255) COLLATE utf8mb4_unicode_ci DEFAULT NULL
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
 
 
@@ -35,7 +39,19 @@ CREATE TABLE `messages` (
 
 CREATE TABLE `tokens` (
   `token_id` char(32) COLLATE utf8mb4_unicode_ci NOT NULL,
-  `created_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6)
+  `created_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6),
+  `last_activity_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6),
+  `weight` smallint UNSIGNED NOT NULL DEFAULT 1,
+  `vfinish` double NOT NULL DEFAULT 0
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
+
+--
+-- Table structure for table `revoked_tokens`
+--
+
+CREATE TABLE `revoked_tokens` (
+  `token_id` char(32) COLLATE utf8mb4_unicode_ci NOT NULL,
+  `revoked_at` datetime(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_unicode_ci;
 
 --
@@ -43,13 +59,23 @@ CREATE TABLE `tokens` (
 --
 ALTER TABLE `messages`
   ADD PRIMARY KEY (`id`),
-  ADD KEY `idx_token_created` (`token_id`,`created_at`);
+  ADD KEY `idx_token_created` (`token_id`,`created_at`),
+  ADD UNIQUE KEY `idx_token_idem` (`token_id`,`idem_key`),
+  ADD KEY `idx_queue` (`status`,`started_at`,`sched_tag`);
 
 --
 -- Indexes for table `tokens`
 --
 ALTER TABLE `tokens`
-  ADD PRIMARY KEY (`token_id`);
+  ADD PRIMARY KEY (`token_id`),
+  ADD KEY `idx_last_activity` (`last_activity_at`);
+
+--
+-- Indexes for table `revoked_tokens`
+--
+ALTER TABLE `revoked_tokens`
+  ADD PRIMARY KEY (`token_id`),
+  ADD KEY `idx_revoked_at` (`revoked_at`);
 
 --
 -- AUTO_INCREMENT for table `messages`
@@ -0,0 +1,200 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- bench_prompt.php
+ * - Offline prompt size benchmark: replays recorded conversations through
+ *   prompt.php and counts the tokens of the first model request of every
+ *   turn, the way process_request.php would send it
+ *     system:    system role content
+ *     functions: web_search, get_time and compose_reply schemas
+ *     history:   earlier turns replayed from the messages table
+ *     question:  the user's message
+ *     output:    the stored reply (reasoning tokens are not recorded)
+ * - Tokens are estimated locally (bench_tokens()) without the model's
+ *   vocabulary, so the counts are a relative size metric, not what OpenAI
+ *   bills. The estimate is deterministic, so two versions of the prompt
+ *   measured with it compare fairly, which is what it is for; no network
+ *   access is needed.
+ * - The corpus is JSON lines, one conversation per line:
+ *     {"caps":{"platform":"atari","cols":40},"messages":[{"role":"user","content":"..."},
+ *      {"role":"assistant","content":"{\"text_display\":\"...\",\"text_sam\":\"...\"}"}]}
+ *   --record writes one from the database, prompt_corpus.jsonl is a sample
+ * - --save keeps the per turn averages as a baseline, --baseline compares
+ *   against one and exits with 1 if a component grew by more than the
+ *   tolerance (default 2% of the estimate)
+ *
+ * Usage examples:
+ *   php bench_prompt.php prompt_corpus.jsonl
+ *   php bench_prompt.php prompt_corpus.jsonl --save prompt_baseline.json
+ *   php bench_prompt.php prompt_corpus.jsonl --baseline prompt_baseline.json 5
+ *   php bench_prompt.php --record my_corpus.jsonl 100   # 100 busiest tokens
+ */
+
+if (PHP_SAPI !== 'cli') exit;
+
+include_once "includes.php";
+include_once "prompt.php";
+
+define('BENCH_MESSAGE_TOKENS', 3);  // chat format overhead per message
+define('BENCH_REPLY_TOKENS', 3);    // and for priming the reply
+
+$components = ["system", "functions", "history", "question", "input", "output"];
+
+/**
+ * Estimated token count of a string, for comparing sizes only. The text
+ * is split the way GPT tokenizers pre-split it (words with their leading
+ * space, numbers in groups of up to 3 digits, punctuation runs,
+ * whitespace). Common words are one token, longer words one per 6
+ * characters, punctuation about one per 2 characters and other
+ * characters one each.
+ */
+function bench_tokens($text)
+{
+    $text = (string)$text;
+    if ($text === '') return 0;
+
+    preg_match_all("/'(?:[sdmt]|ll|ve|re)| ?\\p{L}+| ?\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)|\\s+/u", $text, $pieces);
+    $tokens = 0;
+    foreach ($pieces[0] as $piece) {
+        $chars = mb_strlen($piece, 'UTF-8');
+        if (strlen($piece) !== $chars) {
+            $tokens += $chars;  // non-ASCII
+        } elseif (preg_match('/^ ?[A-Za-z]+$/', $piece)) {
+            $tokens += max(1, (int)ceil($chars / 6));
+        } elseif (preg_match('/^ ?[^\s\w]+$/', $piece)) {
+            $tokens += (int)ceil($chars / 2);
+        } else {
+            $tokens++;
+        }
+    }
+    return $tokens;
+}
+
+function bench_message_tokens($message)
+{
+    return BENCH_MESSAGE_TOKENS + bench_tokens($message['role']) + bench_tokens($message['content']);
+}
+
+/**
+ * Write a corpus of the $limit tokens with the most stored messages.
+ */
+function bench_record($path, $limit)
+{
+    $pdo = db_connect();
+    $stmt = $pdo->prepare(
+        "SELECT token_id FROM messages WHERE status = 0
+          GROUP BY token_id ORDER BY COUNT(*) DESC LIMIT :limit_rows"
+    );
+    $stmt->bindValue(':limit_rows', (int)$limit, PDO::PARAM_INT);
+    $stmt->execute();
+    $tokens = $stmt->fetchAll(PDO::FETCH_COLUMN, 0);
+
+    $out = fopen($path, "w");
+    $rows = $pdo->prepare("SELECT role, content, caps FROM messages WHERE token_id = ? AND status = 0 ORDER BY created_at ASC, id ASC");
+    foreach ($tokens as $token) {
+        $rows->execute([$token]);
+        $conversation = ["caps" => [], "messages" => []];
+        foreach ($rows->fetchAll() as $row) {
+            if ($row['caps']) $conversation["caps"] = json_decode($row['caps'], true) ?: [];
+            $conversation["messages"][] = ["role" => $row['role'], "content" => $row['content']];
+        }
+        fwrite($out, json_encode($conversation) . "\n");
+    }
+    fclose($out);
+    printf("Recorded %d conversations to %s\n", count($tokens), $path);
+}
+
+if (($argv[1] ?? '') === "--record") {
+    if (!isset($argv[2])) {
+        fwrite(STDERR, "usage: php bench_prompt.php --record CORPUS_FILE [TOKENS]\n");
+        exit(1);
+    }
+    bench_record($argv[2], max(1, (int)($argv[3] ?? 100)));
+    exit;
+}
+
+$lines = isset($argv[1]) ? @file($argv[1], FILE_IGNORE_NEW_LINES | FILE_SKIP_EMPTY_LINES) : false;
+if (!$lines) {
+    fwrite(STDERR, "usage: php bench_prompt.php CORPUS_FILE [--save BASELINE | --baseline BASELINE [TOLERANCE_PERCENT]]\n");
+    exit(1);
+}
+$mode = $argv[2] ?? '';
+$baselinePath = $argv[3] ?? '';
+$tolerance = (float)($argv[4] ?? 2);
+
+$total = array_fill_keys($components, 0);
+$turns = 0;
+
+printf("%-6s %-30s %7s %9s %8s %8s %7s %7s\n", "turn", "question", "system", "functions", "history", "question", "input", "output");
+foreach ($lines as $n => $line) {
+    $conversation = json_decode($line, true);
+    if (!is_array($conversation) || !isset($conversation['messages'])) {
+        fwrite(STDERR, "line " . ($n + 1) . ": not a conversation, skipped\n");
+        continue;
+    }
+    $caps = client_caps($conversation['caps'] ?? []);
+    $systemContent = prompt_system($caps, $maxSearches);
+    $functionTokens = bench_tokens(json_encode(prompt_functions($caps)));
+    $rows = $conversation['messages'];
+
+    foreach ($rows as $i => $row) {
+        if ($row['role'] !== 'user') continue;
+
+        // process_request.php reads the last $historyLimit rows, which end
+        // with this question
+        $history = array_slice($rows, max(0, $i + 1 - $historyLimit), min($i + 1, $historyLimit));
+        $messages = prompt_messages($systemContent, $history);
+
+        $turn = array_fill_keys($components, 0);
+        $turn["system"] = bench_message_tokens(array_shift($messages));
+        $turn["question"] = bench_message_tokens(array_pop($messages));
+        foreach ($messages as $message) $turn["history"] += bench_message_tokens($message);
+        $turn["functions"] = $functionTokens;
+        $turn["input"] = $turn["system"] + $turn["functions"] + $turn["history"] + $turn["question"] + BENCH_REPLY_TOKENS;
+
+        $reply = $rows[$i + 1] ?? null;
+        if ($reply && $reply['role'] === 'assistant') $turn["output"] = bench_tokens($reply['content']);
+
+        foreach ($components as $c) $total[$c] += $turn[$c];
+        $turns++;
+        printf("%-6s %-30s %7d %9d %8d %8d %7d %7d\n", ($n + 1) . "." . $i, substr(str_replace("\n", " ", $row['content']), 0, 30),
+            $turn["system"], $turn["functions"], $turn["history"], $turn["question"], $turn["input"], $turn["output"]);
+    }
+}
+
+if ($turns === 0) {
+    fwrite(STDERR, "No turns in the corpus\n");
+    exit(1);
+}
+
+$average = [];
+foreach ($components as $c) $average[$c] = round($total[$c] / $turns, 1);
+printf("\n%d turns, tokens per turn:\n", $turns);
+foreach ($components as $c) printf("  %-10s %8.1f\n", $c, $average[$c]);
+
+if ($mode === "--save" && $baselinePath !== '') {
+    file_put_contents($baselinePath, json_encode(["turns" => $turns, "average" => $average], JSON_PRETTY_PRINT) . "\n");
+    printf("Baseline saved to %s\n", $baselinePath);
+} elseif ($mode === "--baseline" && $baselinePath !== '') {
+    $baseline = json_decode((string)@file_get_contents($baselinePath), true);
+    if (!isset($baseline['average'])) {
+        fwrite(STDERR, "Cannot read baseline $baselinePath\n");
+        exit(1);
+    }
+
+    $regressed = false;
+    printf("\nAgainst %s (tolerance %.1f%%):\n", $baselinePath, $tolerance);
+    foreach ($components as $c) {
+        $before = (float)($baseline['average'][$c] ?? 0);
+        $change = $before > 0 ? ($average[$c] - $before) / $before * 100 : 0;
+        $flag = $change > $tolerance ? "  REGRESSION" : "";
+        if ($flag) $regressed = true;
+        printf("  %-10s %8.1f -> %8.1f  %+6.1f%%%s\n", $c, $before, $average[$c], $change, $flag);
+    }
+    exit($regressed ? 1 : 0);
+}
+?>
@@ -0,0 +1,97 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- bench_search.php
+ * - Compares the latency of the two ways a search question is finished
+ *   once the model has asked for a search (the first model call is the
+ *   same for both and not timed):
+ *     loop:     search summary, then the main model composing the reply
+ *     grounded: one grounded_reply() call writing the reply itself
+ * - Queries come from a file, one per line (e.g. taken from the log),
+ *   and are sent to the OpenAI API with $API_KEY
+ *
+ * Usage examples:
+ *   php bench_search.php queries.txt
+ *   php bench_search.php queries.txt 3    # run each query 3 times
+ */
+
+if (PHP_SAPI !== 'cli') exit;
+
+include_once "includes.php";
+include_once "openai.php";
+
+$lines = isset($argv[1]) ? @file($argv[1], FILE_IGNORE_NEW_LINES | FILE_SKIP_EMPTY_LINES) : false;
+if (!$lines) {
+    fwrite(STDERR, "usage: php bench_search.php QUERY_FILE [RUNS]\n");
+    exit(1);
+}
+$runs = max(1, (int)($argv[2] ?? 1));
+$caps = client_caps([]);
+
+$compose = [[
+    'name'        => 'compose_reply',
+    'description' => 'Finish by providing the text fields for the user',
+    'parameters'  => [
+        'type'       => 'object',
+        'properties' => [
+            'text_display' => ['type' => 'string'],
+            'text_sam'     => ['type' => 'string']
+        ],
+        'required'   => ['text_display', 'text_sam']
+    ]
+]];
+
+/**
+ * The current loop after the model asked for a search: summary, then the
+ * main model writes the reply from it. Returns true if it got a reply.
+ */
+function bench_loop($query)
+{
+    global $API_KEY, $compose, $log_errors, $log_file;
+
+    $result = search_web_via_openai($API_KEY, $query, $log_errors, $log_file);
+    $payload = [
+        'model'         => 'gpt-5-mini',
+        'messages'      => [
+            ['role' => 'system', 'content' => 'You are SAM, a text-to-speech assistant. Answer in 960 characters or less and call compose_reply.'],
+            ['role' => 'user', 'content' => $query],
+            ['role' => 'assistant', 'content' => json_encode(['action' => 'web_search', 'query' => $query])],
+            ['role' => 'system', 'content' => 'Search result: ' . $result]
+        ],
+        'functions'     => $compose,
+        'function_call' => ['name' => 'compose_reply'],
+    ];
+    [$data, $err] = call_openai_chat($API_KEY, $payload, $log_errors, $log_file);
+    return !$err && isset($data['choices'][0]['message']['function_call']);
+}
+
+$total = ["loop" => 0.0, "grounded" => 0.0];
+$failed = ["loop" => 0, "grounded" => 0];
+$count = 0;
+
+printf("%-40s %10s %10s\n", "query", "loop s", "grounded s");
+foreach ($lines as $query) {
+    for ($run = 0; $run < $runs; $run++) {
+        $start = microtime(true);
+        if (!bench_loop($query)) $failed["loop"]++;
+        $loop = microtime(true) - $start;
+
+        $start = microtime(true);
+        [$reply] = grounded_reply($API_KEY, [['role' => 'user', 'content' => $query]], $query, $caps, $log_errors, $log_file);
+        if (!$reply) $failed["grounded"]++;
+        $grounded = microtime(true) - $start;
+
+        $total["loop"] += $loop;
+        $total["grounded"] += $grounded;
+        $count++;
+        printf("%-40s %10.2f %10.2f\n", substr($query, 0, 40), $loop, $grounded);
+    }
+}
+
+printf("%-40s %10.2f %10.2f\n", "average", $total["loop"] / $count, $total["grounded"] / $count);
+printf("%-40s %10d %10d\n", "no usable reply", $failed["loop"], $failed["grounded"]);
+?>
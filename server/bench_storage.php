@@ -0,0 +1,100 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- bench_storage.php
+ * - Measures the database work of one request per endpoint on a storage
+ *   backend, on a connection that is reused as the persistent MySQL
+ *   connections and the gateway and worker processes do
+ *     submit:   one transaction with token activity, queue tag and the
+ *               user + assistant rows
+ *     check:    message lookup of a poll that missed the status cache
+ *     complete: the worker storing the reply
+ *     connect:  opening a new connection, reported on its own; a web
+ *               request pays it with SQLite and when MySQL connections
+ *               are not persistent
+ * - SQLite runs on a scratch file in the temp directory. MySQL uses the
+ *   configured database with a throwaway token and removes its rows again.
+ *
+ * Usage examples:
+ *   php bench_storage.php sqlite
+ *   php bench_storage.php mysql 500
+ */
+
+if (PHP_SAPI !== 'cli') exit;
+
+include_once "includes.php";
+include_once "scheduler.php";
+
+$dbDriver = (($argv[1] ?? "sqlite") === "mysql") ? "mysql" : "sqlite";
+$rounds = max(1, (int)($argv[2] ?? 200));
+
+if ($dbDriver === "sqlite") {
+    $sqlitePath = sys_get_temp_dir() . "/ai-sam-bench.sqlite";
+    foreach (["", "-wal", "-shm"] as $suffix) @unlink($sqlitePath . $suffix);
+}
+
+$token_key = bin2hex(random_bytes(16));
+$times = ["submit" => [], "check" => [], "complete" => [], "connect" => []];
+
+/**
+ * Time $work in milliseconds on the open connection.
+ */
+function bench($work)
+{
+    $pdo = db_connect();
+    $start = hrtime(true);
+    $work($pdo);
+    return (hrtime(true) - $start) / 1e6;
+}
+
+bench(function ($pdo) use ($token_key) {
+    $stmt = $pdo->prepare("INSERT INTO tokens (token_id) VALUES (?)");
+    $stmt->execute([$token_key]);
+});
+
+for ($i = 0; $i < $rounds; $i++) {
+    $assistant_id = null;
+
+    $times["submit"][] = bench(function ($pdo) use ($token_key, &$assistant_id) {
+        $pdo->beginTransaction();
+        db_touch_token($pdo, $token_key);
+        scheduler_enqueue($pdo, $token_key);
+        $assistant_id = db_insert_turn($pdo, $token_key, "How far is the moon?", null, "{}");
+        $pdo->commit();
+    });
+
+    $times["check"][] = bench(function ($pdo) use ($token_key, $assistant_id) {
+        $stmt = $pdo->prepare("SELECT content, status FROM messages WHERE id = ? AND token_id = ? AND role = 'assistant'");
+        $stmt->execute([$assistant_id, $token_key]);
+        $stmt->fetch();
+    });
+
+    $times["complete"][] = bench(function ($pdo) use ($assistant_id) {
+        $stmt = $pdo->prepare("UPDATE messages SET content=?, status=0 WHERE id=? AND status=1");
+        $stmt->execute(['{"text_display":"About 384400 km.","text_sam":"About three hundred eighty four thousand kilometers."}', $assistant_id]);
+    });
+
+    $start = hrtime(true);
+    db_connect(true);
+    $times["connect"][] = (hrtime(true) - $start) / 1e6;
+}
+
+$pdo = db_connect();
+$stmt = $pdo->prepare("DELETE FROM messages WHERE token_id = ?");
+$stmt->execute([$token_key]);
+$stmt = $pdo->prepare("DELETE FROM tokens WHERE token_id = ?");
+$stmt->execute([$token_key]);
+
+echo "$dbDriver, $rounds rounds (ms per request)\n";
+printf("%-10s %8s %8s %8s %8s\n", "", "avg", "p50", "p95", "max");
+foreach ($times as $name => $samples) {
+    sort($samples);
+    $n = count($samples);
+    printf("%-10s %8.3f %8.3f %8.3f %8.3f\n", $name,
+        array_sum($samples) / $n, $samples[(int)($n * 0.5)], $samples[min($n - 1, (int)($n * 0.95))], $samples[$n - 1]);
+}
+?>
@@ -0,0 +1,33 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- cancel_request.php
+ * Called by the FujiNet client when the user gives up on a turn.
+ * - Marks the pending assistant row cancelled (status 2) and drops the
+ *   question from the history
+ * - Publishes "cancelled" to the status cache, which makes a running
+ *   process_request.php abort its OpenAI calls and tool loop
+ * - Starts the next queued request in the freed slot (see scheduler.php)
+ * The work is done by cancel_answer() in handlers.php.
+ *
+ */
+
+include_once "handlers.php";
+
+// Only accept POST requests
+if ($_SERVER['REQUEST_METHOD'] !== 'POST') {
+    http_response_code(405);
+    send_json(["error" => "Method Not Allowed"]);
+    exit;
+}
+
+$result = cancel_answer(file_get_contents("php://input"));
+
+http_response_code($result[0]);
+send_json($result[1]);
+exit;
+?>
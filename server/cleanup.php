@@ -0,0 +1,150 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ * 
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ * 
+ * GPL v3 License
+ * ------------- cleanup.php
+ * - Deletes tokens whose tokens.last_activity_at is older than $daysLimit days,
+ *   together with their messages, in small batches
+ * - Each batch is found through the last_activity_at index and deleted in its
+ *   own short transaction, so no long table scans or long held locks
+ * - Revoked tokens are forgotten once they would have expired anyway
+ * - cleanup_tick() is called by the worker after each reply and runs at most
+ *   one batch per $cleanupIntervalSeconds (it continues right away while
+ *   there is a backlog)
+ */
+
+include_once "includes.php";
+
+/**
+ * Delete up to $batchSize idle tokens and their messages.
+ * Returns [deletedTokens, deletedMessages].
+ */
+function cleanup_tokens_batch($pdo, $cutoffDate, $batchSize)
+{
+    $stmt = $pdo->prepare(
+        "SELECT token_id
+           FROM tokens
+          WHERE last_activity_at < ?
+       ORDER BY last_activity_at
+          LIMIT " . (int)$batchSize
+    );
+    $stmt->execute([$cutoffDate]);
+    $keys = $stmt->fetchAll(PDO::FETCH_COLUMN, 0);
+    if (!$keys) return [0, 0];
+
+    $placeholders = implode(',', array_fill(0, count($keys), '?'));
+
+    $pdo->beginTransaction();
+    try {
+        // Check activity again so a token used since the SELECT survives
+        $stmt = $pdo->prepare("DELETE FROM tokens WHERE token_id IN ($placeholders) AND last_activity_at < ?");
+        $stmt->execute(array_merge($keys, [$cutoffDate]));
+        $deletedTokens = $stmt->rowCount();
+
+        $stmt = $pdo->prepare(
+            "DELETE FROM messages
+              WHERE token_id IN ($placeholders)
+                AND NOT EXISTS (SELECT 1 FROM tokens AS t WHERE t.token_id = messages.token_id)"
+        );
+        $stmt->execute($keys);
+        $deletedMessages = $stmt->rowCount();
+
+        $pdo->commit();
+    } catch (Throwable $e) {
+        $pdo->rollBack();
+        throw $e;
+    }
+
+    return [$deletedTokens, $deletedMessages];
+}
+
+/**
+ * Drop revocations of tokens that have expired by now.
+ */
+function cleanup_revoked_tokens($pdo)
+{
+    global $tokenLifetimeDays;
+
+    $stmt = $pdo->prepare("DELETE FROM revoked_tokens WHERE revoked_at < " . sql_seconds_ago());
+    $stmt->execute([(int)$tokenLifetimeDays * 86400]);
+    return $stmt->rowCount();
+}
+
+/**
+ * Remove status cache entries older than a day and revoked token entries
+ * once those tokens would have expired anyway.
+ */
+function cleanup_state_files($now)
+{
+    global $stateDir, $tokenLifetimeDays;
+
+    $statusFiles = glob($stateDir . "/status/*") ?: [];
+    foreach ($statusFiles as $file) {
+        $mtime = @filemtime($file);
+        if ($mtime !== false && ($now - $mtime) > 86400) {
+            @unlink($file);
+        }
+    }
+
+    $revokedFiles = glob($stateDir . "/revoked/*") ?: [];
+    foreach ($revokedFiles as $file) {
+        $mtime = @filemtime($file);
+        if ($mtime !== false && ($now - $mtime) > $tokenLifetimeDays * 86400) {
+            @unlink($file);
+        }
+    }
+}
+
+function cleanup_cutoff($daysLimit)
+{
+    return (new DateTimeImmutable("now"))
+        ->modify("-{$daysLimit} days")
+        ->format("Y-m-d H:i:s");
+}
+
+/**
+ * Run one cleanup batch if the last one was long enough ago.
+ * Errors are logged and otherwise ignored; the reply has already been stored.
+ */
+function cleanup_tick($pdo)
+{
+    global $stateDir, $daysLimit, $cleanupIntervalSeconds, $cleanupBatchSize, $log_errors, $log_file;
+
+    $now = time();
+    $marker = $stateDir . "/cleanup_last_run";
+    $lastRun = @filemtime($marker);
+    if ($lastRun !== false && ($now - $lastRun) < $cleanupIntervalSeconds) {
+        return;
+    }
+
+    // Claim this run early to keep parallel workers from doing the same batch
+    if (!is_dir($stateDir)) @mkdir($stateDir, 0700, true);
+    @touch($marker, $now);
+
+    try {
+        [$deletedTokens, $deletedMessages] = cleanup_tokens_batch($pdo, cleanup_cutoff($daysLimit), $cleanupBatchSize);
+        if ($deletedTokens < $cleanupBatchSize) cleanup_revoked_tokens($pdo);
+    } catch (Throwable $e) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " cleanup error: " . $e->getMessage() . "\n", FILE_APPEND);
+        return;
+    }
+
+    if ($deletedTokens >= $cleanupBatchSize) {
+        // Backlog left, let the next worker continue without waiting
+        @touch($marker, $now - $cleanupIntervalSeconds);
+    } else {
+        cleanup_state_files($now);
+    }
+
+    if ($log_errors && $deletedTokens > 0) {
+        file_put_contents(
+            $log_file,
+            date("[Y-m-d H:i:s]") . " cleanup: deletedTokens={$deletedTokens}, deletedMessages={$deletedMessages}\n",
+            FILE_APPEND
+        );
+    }
+}
+?>
@@ -0,0 +1,363 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- gateway.php
+ * Single process, event driven front end for many FujiNet clients, run
+ * from the CLI (php gateway.php) in place of the endpoint scripts:
+ * - Serves check_request.php, submit_request.php and cancel_request.php
+ *   with the same JSON API (handlers.php) on $gatewayListen, over HTTP/1.1
+ *   with keep-alive
+ * - Held polls and submits waiting for a quick answer are parked
+ *   connections instead of web server processes, so thousands of waiting
+ *   clients cost a socket each
+ * - Workers announce finished turns on a unix datagram socket
+ *   ($stateDir/gateway.sock, see gateway_notify()), so nothing is polled
+ *   while a connection is held
+ * - Only submits, cancels and answered polls touch the database. Those
+ *   queries run inline and stall the loop for their duration
+ *
+ */
+
+if (PHP_SAPI !== 'cli') exit;
+
+include_once "handlers.php";
+
+// scheduler_dispatch() starts process_request.php by relative path
+chdir(__DIR__);
+
+define('GATEWAY_MAX_REQUEST', 16384); // bytes of headers or body
+define('GATEWAY_IDLE_SECONDS', 60);   // idle keep-alive connections are closed after this
+// stream_select() fails once a descriptor reaches FD_SETSIZE (1024). This
+// leaves room for stdio, the listen and notify sockets, the database and the log.
+define('GATEWAY_SELECT_CLIENTS', 1000);
+
+// A held request costs the gateway a socket, not a process
+$maxCheckWaitSeconds = $gatewayCheckWaitSeconds;
+$maxSubmitWaitSeconds = $gatewaySubmitWaitSeconds;
+
+$httpStatus = [
+    200 => "OK",
+    400 => "Bad Request",
+    403 => "Forbidden",
+    404 => "Not Found",
+    405 => "Method Not Allowed",
+    409 => "Conflict",
+    500 => "Internal Server Error",
+    503 => "Service Unavailable",
+];
+
+$clients = [];  // socket id => connection state
+$parked = [];   // message id => [socket id => true]
+
+/**
+ * Take one complete request off a connection's input buffer.
+ * Returns the request, null if more input is needed, or false if the
+ * request is malformed or too large.
+ */
+function gateway_parse(&$client)
+{
+    $end = strpos($client['in'], "\r\n\r\n");
+    if ($end === false)
+        return strlen($client['in']) > GATEWAY_MAX_REQUEST ? false : null;
+
+    $lines = explode("\r\n", substr($client['in'], 0, $end));
+    $start = explode(" ", array_shift($lines));
+    if (count($start) !== 3) return false;
+
+    $headers = [];
+    foreach ($lines as $line) {
+        $colon = strpos($line, ":");
+        if ($colon) $headers[strtolower(trim(substr($line, 0, $colon)))] = trim(substr($line, $colon + 1));
+    }
+
+    $length = (int)($headers['content-length'] ?? 0);
+    if ($length < 0 || $length > GATEWAY_MAX_REQUEST) return false;
+    if (strlen($client['in']) < $end + 4 + $length) return null;
+
+    $body = substr($client['in'], $end + 4, $length);
+    $client['in'] = (string)substr($client['in'], $end + 4 + $length);
+
+    $connection = strtolower($headers['connection'] ?? "");
+    $keepAlive = ($start[2] === "HTTP/1.1") ? $connection !== "close" : $connection === "keep-alive";
+
+    return ['method' => $start[0], 'target' => $start[1], 'body' => $body, 'keep' => $keepAlive];
+}
+
+/**
+ * Queue a JSON response on a connection.
+ */
+function gateway_respond($id, $code, $response)
+{
+    global $clients, $httpStatus;
+
+    $body = json_encode($response);
+    $client = &$clients[$id];
+    $client['out'] .= "HTTP/1.1 $code " . ($httpStatus[$code] ?? "OK") . "\r\n"
+        . "Content-Type: application/json\r\n"
+        . "Content-Length: " . strlen($body) . "\r\n"
+        . "Connection: " . ($client['keep'] ? "keep-alive" : "close") . "\r\n\r\n"
+        . $body;
+    $client['parked'] = null;
+    gateway_flush($id);
+}
+
+/**
+ * Write as much queued output as the socket takes. A connection that is
+ * not kept alive is closed once its response is out.
+ */
+function gateway_flush($id)
+{
+    global $clients;
+
+    $client = &$clients[$id];
+    if ($client['out'] !== "") {
+        $n = @fwrite($client['sock'], $client['out']);
+        if ($n === false) {
+            gateway_close($id);
+            return;
+        }
+        $client['out'] = (string)substr($client['out'], $n);
+    }
+    if ($client['out'] === "" && !$client['keep'])
+        gateway_close($id);
+}
+
+function gateway_close($id)
+{
+    global $clients, $parked;
+
+    if (!isset($clients[$id])) return;
+    $held = $clients[$id]['parked'];
+    if ($held !== null) {
+        unset($parked[$held['message_id']][$id]);
+        if (empty($parked[$held['message_id']])) unset($parked[$held['message_id']]);
+    }
+    fclose($clients[$id]['sock']);
+    unset($clients[$id]);
+}
+
+/**
+ * Hold a connection until message_id finishes or $wait seconds pass.
+ * $finish($held) builds the response, $held being the seconds waited
+ * or 0 if the turn finished.
+ */
+function gateway_park($id, $message_id, $wait, $finish)
+{
+    global $clients, $parked;
+
+    $clients[$id]['parked'] = [
+        'message_id' => $message_id,
+        'wait'       => $wait,
+        'deadline'   => microtime(true) + $wait,
+        'finish'     => $finish
+    ];
+    $parked[$message_id][$id] = true;
+}
+
+function gateway_unpark($id, $held)
+{
+    global $clients, $parked;
+
+    $park = $clients[$id]['parked'];
+    unset($parked[$park['message_id']][$id]);
+    if (empty($parked[$park['message_id']])) unset($parked[$park['message_id']]);
+
+    $result = gateway_run(function () use ($park, $held) {
+        return ($park['finish'])($held);
+    });
+    gateway_respond($id, $result[0], $result[1]);
+}
+
+/**
+ * Run a handler. A database error drops the connection so the next
+ * request gets a fresh one (MySQL may have closed an idle connection).
+ * Any other error fails only this request, not the gateway.
+ */
+function gateway_run($handler)
+{
+    global $log_errors, $log_file;
+
+    try {
+        return $handler();
+    } catch (PDOException $e) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Gateway database error: " . $e->getMessage() . "\n", FILE_APPEND);
+        try {
+            db_connect(true);
+        } catch (PDOException $e) {
+            // Tried again with the next request
+        }
+        return [500, ["error" => "Database connection failed"]];
+    } catch (Throwable $e) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Gateway request error: " . $e->getMessage() . "\n", FILE_APPEND);
+        return [500, ["error" => "Internal Server Error"]];
+    }
+}
+
+/**
+ * Handle one request on a connection, answering it or parking it.
+ */
+function gateway_request($id, $request)
+{
+    global $maxCheckWaitSeconds;
+
+    $endpoint = basename((string)parse_url($request['target'], PHP_URL_PATH));
+    parse_str((string)parse_url($request['target'], PHP_URL_QUERY), $query);
+
+    if ($endpoint === "check_request.php") {
+        $message_id = $query['message_id'] ?? null;
+        $token_id   = $query['token_id'] ?? null;
+        $wait = min((int)($query['wait'] ?? 0), $maxCheckWaitSeconds);
+
+        $result = gateway_run(function () use ($token_id, $message_id, $wait) {
+            return check_answer($token_id, $message_id, $wait > 0);
+        });
+        if ($result === null) {
+            gateway_park($id, (int)$message_id, $wait, function ($held) use ($token_id, $message_id) {
+                return check_finish($token_id, $message_id, $held);
+            });
+            return;
+        }
+    } elseif ($endpoint === "submit_request.php" || $endpoint === "cancel_request.php") {
+        if ($request['method'] !== "POST") {
+            gateway_respond($id, 405, ["error" => "Method Not Allowed"]);
+            return;
+        }
+
+        $body = $request['body'];
+        if ($endpoint === "cancel_request.php") {
+            $result = gateway_run(function () use ($body) {
+                return cancel_answer($body);
+            });
+        } else {
+            $result = gateway_run(function () use ($body) {
+                return submit_answer($body);
+            });
+            if (($result[2] ?? 0) > 0) {
+                $pending = $result[1];
+                gateway_park($id, (int)$pending['message_id'], $result[2], function ($held) use ($pending) {
+                    return [200, submit_finish($pending)];
+                });
+                return;
+            }
+        }
+    } else {
+        $result = [404, ["error" => "Not Found"]];
+    }
+
+    gateway_respond($id, $result[0], $result[1]);
+}
+
+// Client port
+$listen = @stream_socket_server($gatewayListen, $errno, $errstr);
+if ($listen === false) {
+    fwrite(STDERR, "gateway: cannot listen on $gatewayListen: $errstr\n");
+    exit(1);
+}
+stream_set_blocking($listen, false);
+
+// Worker notifications
+if (!is_dir($stateDir)) @mkdir($stateDir, 0700, true);
+$notifyPath = $stateDir . "/gateway.sock";
+@unlink($notifyPath);
+$notify = @stream_socket_server("udg://" . $notifyPath, $errno, $errstr, STREAM_SERVER_BIND);
+if ($notify === false) {
+    fwrite(STDERR, "gateway: cannot bind $notifyPath: $errstr\n");
+    exit(1);
+}
+stream_set_blocking($notify, false);
+
+$maxClients = min((int)$gatewayMaxClients, GATEWAY_SELECT_CLIENTS);
+
+if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Gateway listening on $gatewayListen\n", FILE_APPEND);
+
+while (true) {
+    $read = [$notify];
+    $write = [];
+    $except = null;
+
+    if (count($clients) < $maxClients) $read[] = $listen;
+    foreach ($clients as $client) {
+        $read[] = $client['sock'];
+        if ($client['out'] !== "") $write[] = $client['sock'];
+    }
+
+    // Holds run out on a one second tick. A failing select would fail again
+    // on every pass, so stop and leave the restart to the supervisor.
+    if (@stream_select($read, $write, $except, 1) === false) {
+        $error = error_get_last()['message'] ?? "unknown error";
+        fwrite(STDERR, "gateway: stream_select failed: $error\n");
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Gateway stream_select failed: $error\n", FILE_APPEND);
+        exit(1);
+    }
+
+    foreach ($read as $sock) {
+        if ($sock === $listen) {
+            $conn = @stream_socket_accept($listen, 0);
+            if ($conn === false) continue;
+            stream_set_blocking($conn, false);
+            $clients[(int)$conn] = [
+                'sock'   => $conn,
+                'in'     => "",
+                'out'    => "",
+                'keep'   => true,
+                'seen'   => time(),
+                'parked' => null
+            ];
+        } elseif ($sock === $notify) {
+            // Finished turns, one message id per datagram
+            while (($data = @stream_socket_recvfrom($notify, 32)) !== false && $data !== "") {
+                $message_id = (int)$data;
+                foreach (array_keys($parked[$message_id] ?? []) as $id)
+                    gateway_unpark($id, 0);
+            }
+        } else {
+            $id = (int)$sock;
+            $data = @fread($sock, 8192);
+            if ($data === false || ($data === "" && feof($sock))) {
+                gateway_close($id);
+                continue;
+            }
+            $clients[$id]['in'] .= $data;
+            $clients[$id]['seen'] = time();
+        }
+    }
+
+    foreach ($write as $sock) {
+        if (isset($clients[(int)$sock])) gateway_flush((int)$sock);
+    }
+
+    $now = microtime(true);
+    foreach (array_keys($clients) as $id) {
+        if (!isset($clients[$id])) continue;
+        $client = $clients[$id];
+
+        if ($client['parked'] !== null) {
+            if ($now >= $client['parked']['deadline'])
+                gateway_unpark($id, $client['parked']['wait']);
+            continue;
+        }
+
+        // One request at a time per connection, in order
+        if ($client['out'] === "" && $client['in'] !== "") {
+            $request = gateway_parse($clients[$id]);
+            if ($request === false) {
+                $clients[$id]['keep'] = false;
+                gateway_respond($id, 400, ["error" => "Bad request"]);
+                continue;
+            }
+            if ($request !== null) {
+                $clients[$id]['keep'] = $request['keep'];
+                gateway_request($id, $request);
+                continue;
+            }
+        }
+
+        if ($client['out'] === "" && time() - $client['seen'] > GATEWAY_IDLE_SECONDS)
+            gateway_close($id);
+    }
+}
+?>
@@ -0,0 +1,487 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- handlers.php
+ * The client protocol without the web server around it, shared by the
+ * endpoint scripts and gateway.php:
+ * - check_answer()  check_request.php
+ * - submit_answer() submit_request.php
+ * - cancel_answer() cancel_request.php
+ * Each returns [http code, response fields]. Nothing in here sleeps: where
+ * the protocol waits for an answer (submit and check with "wait") the
+ * caller does the waiting, the endpoints with status_cache_wait() and the
+ * gateway by parking the connection until a worker reports back.
+ *
+ */
+
+include_once "includes.php";
+include_once "scheduler.php";
+
+/**
+ * Answer a poll for $message_id. Returns null instead if the turn is still
+ * running and $holdable is set, so the caller can hold the poll.
+ * Pending polls are answered from the status cache; anything else costs
+ * one query.
+ */
+function check_answer($token_id, $message_id, $holdable = false)
+{
+    global $jobTimeoutSeconds;
+
+    if (!$message_id || !$token_id || !is_string($token_id) || !is_scalar($message_id)) {
+        return [400, ["error" => "Missing required parameters"]];
+    }
+
+    // Signed tokens are checked here without the database
+    $token = token_parse($token_id);
+    if ($token === null) {
+        return [403, ["error" => "Invalid token"]];
+    }
+    $token_key = $token['key'];
+
+    // The status cache entry was written by the server after it validated the
+    // token, so a matching token_key is enough to use it. An unfinished entry
+    // older than $jobTimeoutSeconds is from a worker that died; the database
+    // has the last word on it (see below).
+    $cached = status_cache_get($message_id);
+    $stale = $cached && !in_array($cached['s'], ["complete", "cancelled"], true)
+        && time() - ($cached['a'] ?? time()) > $jobTimeoutSeconds;
+    if ($cached && $cached['t'] === $token_key && !$stale) {
+        if ($holdable && in_array($cached['s'], ["queued", "running", "pending"], true))
+            return null;
+
+        // Running requests are answered without the database
+        if ($cached['s'] === "running" || $cached['s'] === "pending" || $cached['s'] === "cancelled") {
+            return [200, [
+                "token_id" => $token_id,
+                "status" => ($cached['s'] === "cancelled") ? "cancelled" : "pending"
+            ]];
+        }
+    }
+
+    try {
+        $pdo = db_connect();
+    } catch (PDOException $e) {
+        return [500, ["error" => "Database connection failed"]];
+    }
+
+    // Nothing else may run scheduler_expire() on a quiet server, and until it
+    // does the client can't ask anything new
+    if ($stale) scheduler_expire($pdo);
+
+    // Validate message belongs to this token. Legacy tokens are validated in the
+    // same query: no row means an unknown token, a NULL status an unknown message.
+    if ($token['signed']) {
+        $stmt = db_prepare($pdo, "SELECT content, status FROM messages WHERE id = ? AND token_id = ? AND role = 'assistant'");
+        $stmt->execute([$message_id, $token_key]);
+    } else {
+        $stmt = db_prepare($pdo,
+            "SELECT m.content, m.status
+               FROM tokens AS t
+          LEFT JOIN messages AS m ON m.id = ? AND m.token_id = t.token_id AND m.role = 'assistant'
+              WHERE t.token_id = ?"
+        );
+        $stmt->execute([$message_id, $token_key]);
+    }
+    $row = db_row($stmt);
+
+    if (!$token['signed'] && !$row) {
+        return [403, ["error" => "Invalid token"]];
+    }
+
+    if (!$row || $row['status'] === null) {
+        return [404, [
+            "token_id" => $token_id,
+            "error" => "Message not found or does not belong to this token"
+        ]];
+    }
+
+    if ((int)$row['status'] === 2) {
+        return [200, [
+            "token_id" => $token_id,
+            "status" => "cancelled"
+        ]];
+    }
+
+    if ((int)$row['status'] === 1) {
+        // Still pending, report where it is in the queue if it hasn't started
+        $response = [
+            "token_id" => $token_id,
+            "status" => "pending"
+        ];
+        $position = scheduler_queue_position($pdo, $message_id);
+        if ($position > 0) $response["queue_position"] = $position;
+        return [200, $response];
+    }
+
+    return [200, reply_response($token_id, $row['content'])];
+}
+
+/**
+ * Answer a poll that was held for $held seconds (0 if the turn finished
+ * while it was held).
+ */
+function check_finish($token_id, $message_id, $held)
+{
+    $result = check_answer($token_id, $message_id);
+    if ($held && ($result[1]['status'] ?? null) === "pending")
+        $result[1]["held"] = $held;
+    return $result;
+}
+
+/**
+ * Response for an earlier submission with the same idem_key that is within
+ * $idempotencyWindowSeconds and not cancelled, or null if there is none.
+ */
+function submit_existing($pdo, $token_id, $token_key, $idem_key)
+{
+    global $idempotencyWindowSeconds;
+
+    $stmt = db_prepare($pdo,
+        "SELECT id, status, content
+           FROM messages
+          WHERE token_id = ?
+            AND idem_key = ?
+            AND role = 'assistant'
+            AND status <> 2
+            AND created_at > " . sql_seconds_ago() . "
+          LIMIT 1"
+    );
+    $stmt->execute([$token_key, $idem_key, (int)$idempotencyWindowSeconds]);
+    $existing = db_row($stmt);
+    if (!$existing) return null;
+
+    if ((int)$existing['status'] === 0)
+        return [200, ["message_id" => $existing['id']] + reply_response($token_id, $existing['content']), 0];
+    return [200, [
+        'token_id' => $token_id,
+        "message_id" => $existing['id'],
+        "status" => "pending"
+    ], 0];
+}
+
+/**
+ * Handle a submission (the raw JSON body). Returns [http code, response
+ * fields, wait] where wait is the number of seconds the client is willing
+ * to wait for a quick answer to a newly queued turn, 0 otherwise.
+ */
+function submit_answer($inputJSON)
+{
+    global $defaultKey, $idempotencyWindowSeconds, $maxSubmitWaitSeconds, $log_errors, $log_file;
+
+    $decodedInput = json_decode($inputJSON, true);
+
+    // Validate JSON
+    if (!$decodedInput || !is_array($decodedInput)) {
+        if ($log_errors)
+            file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Invalid JSON:\n" . $inputJSON . "\n\n", FILE_APPEND);
+        return [400, ["error" => "Invalid JSON input"], 0];
+    }
+
+    // Fields used as text must be text, a JSON array or number here would
+    // fail further down
+    foreach (['new', 'token_id', 'message'] as $field) {
+        if (isset($decodedInput[$field]) && !is_string($decodedInput[$field])) {
+            return [400, ["error" => "Invalid " . $field], 0];
+        }
+    }
+
+    try {
+        $pdo = db_connect();
+    } catch (PDOException $e) {
+        return [500, ["error" => "Database connection failed"], 0];
+    }
+
+    // Handle new token request
+    if (isset($decodedInput['new']) && $decodedInput['new'] === $defaultKey) {
+        if (isset($decodedInput['token_id']) && $decodedInput['token_id'] !== $defaultKey) {
+            $oldKey = token_key($decodedInput['token_id']);
+            if ($oldKey !== null) {
+                $stmt = db_prepare($pdo, "DELETE FROM messages WHERE token_id = ?");
+                $stmt->execute([$oldKey]);
+                $stmt = db_prepare($pdo, "DELETE FROM tokens WHERE token_id = ?");
+                $stmt->execute([$oldKey]);
+                // A signed token would otherwise stay valid until it expires
+                if (strlen($decodedInput['token_id']) > 32) {
+                    db_revoke_token($pdo, $oldKey);
+                    token_revoke($oldKey);
+                }
+            }
+        }
+
+        $newToken = token_issue();
+        $stmt = db_prepare($pdo, "INSERT INTO tokens (token_id) VALUES (?)");
+        $stmt->execute([token_key($newToken)]);
+
+        return [200, ["token_id" => $newToken], 0];
+    }
+
+    // Verify token
+    if (!isset($decodedInput['token_id'])) {
+        return [200, ["error" => "Missing token_id"], 0];
+    }
+
+    $token_id = $decodedInput['token_id'];
+    $token = token_parse($token_id);
+    if ($token === null) {
+        return [200, [
+            "token_id" => $token_id,
+            "error" => "Invalid token"
+        ], 0];
+    }
+    $token_key = $token['key'];
+
+    // Validate message
+    if (empty($decodedInput['message'])) {
+        return [200, [
+            'token_id' => $token_id,
+            "error" => "Missing message"
+        ], 0];
+    }
+
+    // Trim
+    $message = trim($decodedInput['message']);
+
+    // Remove any control characters except newline
+    $message = preg_replace('/[^\r\n\x20-\x7E]/', '', $message);
+
+    // Collapse multiple whitespace/newlines to single space or newline
+    $message = preg_replace([ "/[ \t]{2,}/", "/\r?\n{2,}/" ], [ ' ', "\n" ], $message);
+
+    // Enforce a reasonable length limit
+    $maxLen = 2048;
+    if (strlen($message) > $maxLen) {
+        $message = substr($message, 0, $maxLen);
+    }
+
+    // Reject if empty after cleaning
+    if ($message === '') {
+        return [400, [
+            'token_id' => $token_id,
+            'error'    => 'Content is empty or contains only invalid characters'
+        ], 0];
+    }
+
+    $idem_key = null;
+    if (isset($decodedInput['idem_key']) && is_string($decodedInput['idem_key'])
+        && preg_match('/^[0-9A-Za-z_-]{1,32}$/', $decodedInput['idem_key'])) {
+        $idem_key = $decodedInput['idem_key'];
+    }
+
+    // Everything from the token check to the new rows is one transaction,
+    // starting with a write so SQLite takes its write lock up front
+    $pdo->beginTransaction();
+    try {
+        if ($token['signed']) {
+            // Record activity for cleanup. A signed token is valid without a
+            // tokens row, and cleanup may have removed it after a long idle
+            // period, so upsert it.
+            db_touch_token($pdo, $token_key);
+
+            // token_parse() only sees revocations made since $stateDir was
+            // last emptied, a reboot forgets them
+            if (db_token_revoked($pdo, $token_key)) {
+                $pdo->rollBack();
+                return [200, [
+                    "token_id" => $token_id,
+                    "error" => "Invalid token"
+                ], 0];
+            }
+        } else {
+            // Legacy unsigned token, only the database knows if it is valid.
+            // Recording the activity doubles as the lookup.
+            $stmt = db_prepare($pdo, "UPDATE tokens SET last_activity_at = NOW(6) WHERE token_id = ?");
+            $stmt->execute([$token_key]);
+            if ($stmt->rowCount() === 0) {
+                $pdo->rollBack();
+                return [200, [
+                    "token_id" => $token_id,
+                    "error" => "Invalid token"
+                ], 0];
+            }
+        }
+
+        // Idempotent retry: a client that lost our previous answer resends the turn
+        // with the same idem_key. Hand back the existing message instead of running
+        // the question again.
+        if ($idem_key !== null) {
+            $existing = submit_existing($pdo, $token_id, $token_key, $idem_key);
+            if ($existing !== null) {
+                $pdo->commit();
+                return $existing;
+            }
+
+            // Keys are unique per token (idx_token_idem). A cancelled turn or
+            // one past the window gives its key up.
+            $stmt = db_prepare($pdo,
+                "UPDATE messages
+                    SET idem_key = NULL
+                  WHERE token_id = ?
+                    AND idem_key = ?
+                    AND (status = 2 OR created_at <= " . sql_seconds_ago() . ")"
+            );
+            $stmt->execute([$token_key, $idem_key, (int)$idempotencyWindowSeconds]);
+        }
+
+        // Admission control, see scheduler.php
+        $rejected = scheduler_admit($pdo, $token_key);
+        if ($rejected !== null) {
+            $pdo->commit();
+            return [$rejected[0], ['token_id' => $token_id] + $rejected[1], 0];
+        }
+
+        // User's message and the placeholder assistant message (pending),
+        // with what the client can show so the worker sizes the reply to it
+        scheduler_enqueue($pdo, $token_key);
+        try {
+            $assistant_id = db_insert_turn($pdo, $token_key, $message, $idem_key, json_encode(client_caps($decodedInput)));
+        } catch (PDOException $e) {
+            // The same retry arrived twice at once and the other one got in
+            // first; answer with its message
+            if ($idem_key === null || $e->getCode() !== '23000') throw $e;
+            $pdo->rollBack();
+            $existing = submit_existing($pdo, $token_id, $token_key, $idem_key);
+            if ($existing === null) throw $e;
+            return $existing;
+        }
+        if ($assistant_id === null) {
+            // Removed by a new token request for the same client meanwhile
+            $pdo->rollBack();
+            return [200, [
+                "token_id" => $token_id,
+                "error" => "Invalid token"
+            ], 0];
+        }
+        $pdo->commit();
+    } catch (Throwable $e) {
+        if ($pdo->inTransaction()) $pdo->rollBack();
+        throw $e;
+    }
+    status_cache_set($assistant_id, $token_key, "queued");
+
+    if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " User Request (token_id ".$token_id."):\n  {".$message."}\n", FILE_APPEND);
+
+    // Start background workers for queued requests if there is capacity
+    scheduler_dispatch($pdo);
+
+    // Quick answers go back with this response if the client is willing to
+    // wait for them (at most $maxSubmitWaitSeconds). Slower ones are polled for.
+    $wait = max(0, min((int)($decodedInput['wait'] ?? 0), $maxSubmitWaitSeconds));
+    return [200, [
+        'token_id' => $token_id,
+        "message_id" => $assistant_id,
+        "status" => "pending"
+    ], $wait];
+}
+
+/**
+ * Response to a submission that waited for its answer: the reply if the
+ * turn is complete, otherwise the pending response unchanged.
+ */
+function submit_finish($response)
+{
+    $cached = status_cache_get($response['message_id']);
+    if (!$cached || $cached['s'] !== "complete") return $response;
+
+    try {
+        $pdo = db_connect();
+    } catch (PDOException $e) {
+        return $response;
+    }
+
+    $stmt = db_prepare($pdo, "SELECT content FROM messages WHERE id = ? AND status = 0");
+    $stmt->execute([$response['message_id']]);
+    $row = db_row($stmt);
+    if (!$row) return $response;
+
+    return ["message_id" => $response['message_id']] + reply_response($response['token_id'], $row['content']);
+}
+
+/**
+ * Cancel an unanswered turn (the raw JSON body).
+ */
+function cancel_answer($inputJSON)
+{
+    global $log_errors, $log_file;
+
+    $decodedInput = json_decode($inputJSON, true);
+    $message_id = $decodedInput['message_id'] ?? null;
+    $token_id   = $decodedInput['token_id'] ?? null;
+
+    if (!$message_id || !$token_id || !is_string($token_id) || !is_scalar($message_id)) {
+        return [400, ["error" => "Missing required parameters"]];
+    }
+
+    $token = token_parse($token_id);
+    if ($token === null) {
+        return [403, ["error" => "Invalid token"]];
+    }
+    $token_key = $token['key'];
+
+    try {
+        $pdo = db_connect();
+    } catch (PDOException $e) {
+        return [500, ["error" => "Database connection failed"]];
+    }
+
+    // Only a turn that is still unanswered can be cancelled. The token check is
+    // part of the update, so a foreign or unknown message changes nothing.
+    $stmt = db_prepare($pdo,
+        "UPDATE messages
+            SET status = 2
+          WHERE id = ?
+            AND token_id = ?
+            AND role = 'assistant'
+            AND status = 1"
+    );
+    $stmt->execute([$message_id, $token_key]);
+
+    if ($stmt->rowCount() === 0) {
+        $stmt = db_prepare($pdo, "SELECT status FROM messages WHERE id = ? AND token_id = ? AND role = 'assistant'");
+        $stmt->execute([$message_id, $token_key]);
+        $row = db_row($stmt);
+        if (!$row) {
+            return [404, [
+                "token_id" => $token_id,
+                "error" => "Message not found or does not belong to this token"
+            ]];
+        }
+        return [200, [
+            "token_id" => $token_id,
+            "status" => ((int)$row['status'] === 0) ? "complete" : "cancelled"
+        ]];
+    }
+
+    status_cache_set($message_id, $token_key, "cancelled");
+
+    // The unanswered question would otherwise be asked again with the next turn
+    $stmt = db_prepare($pdo,
+        "SELECT id
+           FROM messages
+          WHERE token_id = ?
+            AND role = 'user'
+            AND id < ?
+       ORDER BY id DESC
+          LIMIT 1"
+    );
+    $stmt->execute([$token_key, $message_id]);
+    $question = db_value($stmt);
+    if ($question !== false) {
+        $stmt = db_prepare($pdo, "DELETE FROM messages WHERE id = ?");
+        $stmt->execute([$question]);
+    }
+
+    if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Cancelled message $message_id\n", FILE_APPEND);
+
+    // The cancelled turn no longer counts as running or queued
+    scheduler_dispatch($pdo);
+
+    return [200, [
+        "token_id" => $token_id,
+        "status" => "cancelled"
+    ]];
+}
+?>
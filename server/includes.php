@@ -14,7 +14,12 @@ $API_KEY = "YOUR_API_KEY";
 // Default app Token / Key. used as sort of a password to get a unique token for the first time. sent by app
 $defaultKey = "YOUR_DEFAULT_TOKEN_TO_MATCH_APP_CONFIG_H";
 
-// Database Variables
+// Database backend: "mysql", or "sqlite" for a single host without a database server (see storage.php)
+$dbDriver = "mysql";
+// SQLite database file, created on first use. Keep it outside the web root.
+$sqlitePath = "/var/lib/ai-sam/ai-sam.sqlite";
+
+// Database Variables (MySQL)
 $dbhost = "127.0.0.1";
 $dbuser = "YOUR_DB_USERNAME";
 $dbpass = 'YOUR_DB_PASSWORD';
@@ -25,12 +30,340 @@ $historyLimit = 9;
 
 // Default retention: number of days to keep tokens + messages
 $daysLimit = 7;
+// Completion tokens the model may spend on reasoning and tool calls, on top
+// of the reply itself (the reply part is sized to the client, see client_caps())
+$reasoningTokenBudget = 2048;
+
+// Web searches the model may make for one question
+$maxSearches = 2;
+
+// Answer the first web search of a turn with one search model call that
+// writes the reply itself, instead of a summary plus another main model call
+$groundedSearch = true;
+
+// Questions matching this start the web search alongside the first model
+// call, so it is ready if the model asks for it. Unused searches are
+// thrown away; at most this many are started per minute.
+$speculativeSearchPattern = '/\b(today|tonight|tomorrow|yesterday|weather|forecast|latest|current|news|scores?|prices?|stocks?|this week|right now)\b/i';
+$maxSpeculativeSearchesPerMinute = 10;
+
+// Idle tokens are removed in batches of this many, at most once per interval
+$cleanupBatchSize = 200;
+$cleanupIntervalSeconds = 300;
+
+// Request scheduling (see scheduler.php)
+$maxConcurrentJobs = 4;     // requests running against OpenAI at the same time
+$maxQueuedJobs = 50;        // waiting requests before new ones are turned away
+$jobCostSeconds = 20;       // nominal cost of one request for fair queueing
+$jobTimeoutSeconds = 300;   // a request running longer than this is considered dead
+// How turns are started: "exec" runs php process_request.php for each one,
+// "daemon" leaves them to $maxConcurrentJobs worker.php processes, which are
+// woken on a socket instead of a new process being started per turn
+$workerMode = "exec";
+
+// How long a retried submission with the same idem_key returns the earlier message
+$idempotencyWindowSeconds = 600;
+// Longest a submission may wait for its own answer (the client asks with "wait").
+// Like held polls below, a waiting submit keeps a PHP process busy under a web
+// server, so this is 0; gateway.php waits with $gatewaySubmitWaitSeconds.
+$maxSubmitWaitSeconds = 0;
+// Longest a poll is held open until the answer is done (long poll, client asks with "wait").
+// Under a web server every held poll keeps a PHP process busy for the whole
+// turn, so this is 0 (answer at once); gateway.php holds polls with
+// $gatewayCheckWaitSeconds instead. Raise it only with processes to spare.
+$maxCheckWaitSeconds = 0;
+
+// Event loop gateway (gateway.php): address it listens on, and the most
+// client connections it keeps open at once. stream_select() only handles
+// descriptors below 1024 (FD_SETSIZE), so more than 1000 are not accepted.
+$gatewayListen = "tcp://0.0.0.0:8080";
+$gatewayMaxClients = 1000;
+// Longest the gateway holds a poll or a submit waiting for a quick answer,
+// where a held request only costs a socket
+$gatewayCheckWaitSeconds = 20;
+$gatewaySubmitWaitSeconds = 8;
+
+// Secret used to sign tokens (HMAC-SHA256). Use a long random string and keep it private.
+$tokenSecret = "YOUR_TOKEN_SIGNING_SECRET";
+// How many days a signed token stays valid before the client must request a new one
+$tokenLifetimeDays = 365;
+
+// Directory for small shared state files (revoked tokens, message status). tmpfs is preferred;
+// nothing in it has to survive a reboot.
+$stateDir = (is_dir("/dev/shm") ? "/dev/shm" : sys_get_temp_dir()) . "/ai-sam";
 
 // Log File
 $log_errors = 0; // 1 = yes to log them in a file, 0 = no
 $log_file = "ai-sam-api.log";
 $debug = 0; // Extra debug logging
 
+include_once "storage.php";
+
+/**
+ * Signed tokens are 64 hex characters, the maximum size of a FujiNet appkey:
+ *   32 hex token key | 8 hex expiry (unix time) | 24 hex truncated HMAC-SHA256
+ * Only the token key is stored in the database. Older clients may still hold a
+ * plain 32 hex token, which has no signature and is looked up in the database.
+ */
+function token_signature($data)
+{
+    global $tokenSecret;
+    return substr(hash_hmac('sha256', $data, $tokenSecret), 0, 24);
+}
+
+function token_issue()
+{
+    global $tokenLifetimeDays;
+
+    $key = bin2hex(random_bytes(16));
+    $expires = sprintf("%08x", time() + $tokenLifetimeDays * 86400);
+    return $key . $expires . token_signature($key . $expires);
+}
+
+/**
+ * Check a client token in memory.
+ * Returns ['key' => token key, 'signed' => bool], or null if the token is
+ * malformed, forged, expired or revoked. Unsigned (legacy) tokens are returned
+ * with signed = false and must still be checked against the tokens table.
+ */
+function token_parse($token)
+{
+    if (!is_string($token)) return null;
+
+    if (preg_match('/^[0-9a-f]{32}$/', $token))
+        return ['key' => $token, 'signed' => false];
+
+    if (!preg_match('/^([0-9a-f]{32})([0-9a-f]{8})([0-9a-f]{24})$/', $token, $m))
+        return null;
+    if (!hash_equals(token_signature($m[1] . $m[2]), $m[3]))
+        return null;
+    if (hexdec($m[2]) < time())
+        return null;
+    if (token_is_revoked($m[1]))
+        return null;
+
+    return ['key' => $m[1], 'signed' => true];
+}
+
+/**
+ * Token key of a client token, without checking the signature.
+ * Used when deleting an old conversation, which may have an expired token.
+ */
+function token_key($token)
+{
+    if (is_string($token) && preg_match('/^[0-9a-f]{32}/', $token, $m))
+        return $m[0];
+    return null;
+}
+
+/**
+ * Revoked signed tokens are kept as empty files named by token key, so a
+ * revoked token is turned away without the database. The set stays small:
+ * entries are only needed until the token would have expired. $stateDir
+ * doesn't survive a reboot, so submits also check the revoked_tokens table
+ * (db_revoke_token()).
+ */
+function token_revoke($key)
+{
+    global $stateDir;
+
+    $dir = $stateDir . "/revoked";
+    if (!is_dir($dir)) @mkdir($dir, 0700, true);
+    @touch($dir . "/" . $key);
+}
+
+function token_is_revoked($key)
+{
+    global $stateDir;
+    return file_exists($stateDir . "/revoked/" . $key);
+}
+
+/**
+ * Message status cache, one small file per assistant message id.
+ * submit_request.php publishes "pending" and the worker publishes "complete",
+ * so check_request.php can answer pending polls without the database.
+ * APCu is not used because the CLI workers do not share it with the web server.
+ * A finished turn is also announced to gateway.php, if it runs.
+ * Entries carry the time they were written ('a'), so an entry left behind by
+ * a worker that died can be told apart from a turn still running.
+ */
+function status_cache_set($message_id, $token_key, $status)
+{
+    global $stateDir;
+
+    $dir = $stateDir . "/status";
+    if (!is_dir($dir)) @mkdir($dir, 0700, true);
+    $file = $dir . "/" . (int)$message_id;
+    $tmp = $file . "." . getmypid();
+    if (@file_put_contents($tmp, json_encode(['t' => $token_key, 's' => $status, 'a' => time()])) !== false)
+        @rename($tmp, $file);
+
+    if ($status === "complete" || $status === "cancelled")
+        gateway_notify($message_id);
+}
+
+/**
+ * Wake up gateway.php for a message through its datagram socket, so it can
+ * answer the polls it holds. Fire and forget: a lost datagram only means the
+ * poll is answered when its hold runs out.
+ */
+function gateway_notify($message_id)
+{
+    global $stateDir;
+
+    $path = $stateDir . "/gateway.sock";
+    if (!file_exists($path)) return;
+
+    $sock = @stream_socket_client("udg://" . $path, $errno, $errstr, 1);
+    if ($sock === false) return;
+    stream_set_blocking($sock, false);
+    @fwrite($sock, (string)(int)$message_id);
+    fclose($sock);
+}
+
+/**
+ * Wake up idle worker.php processes, each listening on its own datagram
+ * socket in $stateDir/workers. Workers also look at the queue every few
+ * seconds, so a lost datagram only delays a turn.
+ */
+function worker_notify()
+{
+    global $stateDir;
+
+    foreach (glob($stateDir . "/workers/*.sock") ?: [] as $path) {
+        $sock = @stream_socket_client("udg://" . $path, $errno, $errstr, 1);
+        if ($sock === false) continue;
+        stream_set_blocking($sock, false);
+        @fwrite($sock, "1");
+        fclose($sock);
+    }
+}
+
+function status_cache_get($message_id)
+{
+    global $stateDir;
+
+    $data = @file_get_contents($stateDir . "/status/" . (int)$message_id);
+    if ($data === false) return null;
+    $entry = json_decode($data, true);
+    return is_array($entry) ? $entry : null;
+}
+
+/**
+ * Send a JSON response with an explicit length, so a client that keeps the
+ * connection alive can send its next request on it.
+ */
+function send_json($data)
+{
+    $body = json_encode($data);
+    header("Content-Type: application/json");
+    header("Content-Length: " . strlen($body));
+    echo $body;
+}
+
+/**
+ * Wait up to $seconds for a turn to finish, watching the status cache.
+ * Returns "complete" or "cancelled", or null if it is still going.
+ */
+function status_cache_wait($message_id, $seconds)
+{
+    $deadline = microtime(true) + $seconds;
+    do {
+        $cached = status_cache_get($message_id);
+        if ($cached && ($cached['s'] === "complete" || $cached['s'] === "cancelled"))
+            return $cached['s'];
+        usleep(200000);
+    } while (microtime(true) < $deadline);
+    return null;
+}
+
+/**
+ * Response for a finished turn, built from the assistant row's content
+ * ({"text_display":"...","text_sam":"..."} or plain text from older rows).
+ * Used by check_request.php and by submit_request.php when the answer is
+ * ready before it responds.
+ */
+function reply_response($token_id, $content)
+{
+    $payload = json_decode($content, true);
+
+    if (!is_array($payload)) {
+        // Fallback if DB content wasn't a JSON blob
+        $display = convert_atascii($content);
+        $sam = $display;
+    } else {
+        // Enforce device rules & sanitize
+        $display = isset($payload['text_display']) ? convert_atascii($payload['text_display']) : '';
+        $sam     = isset($payload['text_sam'])     ? convert_atascii($payload['text_sam'])     : '';
+        if (strlen($display) > 960) $display = substr($display, 0, 960);
+    }
+
+    return [
+        "token_id"     => $token_id,
+        "status"       => "complete",
+        "text_display" => $display,
+        "text_sam"     => $sam,
+        "sam_chunks"   => sam_chunks($sam)
+    ];
+}
+
+/**
+ * What the client can show and speak, from the capability fields it sends
+ * with a question: platform, cols, rows (the text screen), max_reply (bytes
+ * of display text it keeps) and speech (1 if SAM speaks the reply). Clients
+ * that don't send them get the limits of the original Atari client.
+ */
+function client_caps($input)
+{
+    $number = function ($key, $min, $max, $default) use ($input) {
+        if (!isset($input[$key]) || !is_numeric($input[$key])) return $default;
+        return max($min, min($max, (int)$input[$key]));
+    };
+
+    $platform = $input['platform'] ?? "atari";
+    if (!is_string($platform) || !preg_match('/^[a-z0-9_]{1,16}$/', $platform)) $platform = "atari";
+
+    return [
+        'platform'  => $platform,
+        'cols'      => $number('cols', 20, 132, 40),
+        'rows'      => $number('rows', 8, 60, 20),
+        'max_reply' => $number('max_reply', 64, 960, 960),
+        'speech'    => isset($input['speech']) ? (bool)(int)$input['speech'] : true
+    ];
+}
+
+/**
+ * Split SAM text into chunks SAM can speak in one go (at most $max chars),
+ * breaking after the last sentence end in a chunk, else at the last space.
+ * The Atari client speaks these one at a time from a small buffer.
+ */
+function sam_chunks($text, $max = 100)
+{
+    $chunks = [];
+    $text = trim(preg_replace('/\s+/', ' ', (string)$text));
+
+    while ($text !== '') {
+        if (strlen($text) <= $max) {
+            $chunks[] = $text;
+            break;
+        }
+
+        $window = substr($text, 0, $max);
+        $end = max(strrpos($window, '.'), strrpos($window, '?'), strrpos($window, '!'));
+        if ($end !== false && $end > 0) {
+            $end++;
+        } else {
+            $end = strrpos($window, ' ');
+            if ($end === false || $end === 0) $end = $max;
+        }
+
+        $chunks[] = rtrim(substr($text, 0, $end));
+        $text = ltrim(substr($text, $end));
+    }
+
+    return $chunks;
+}
+
 /**
  * Convert ASCII text to ATASCII
  */
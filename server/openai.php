@@ -0,0 +1,218 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- openai.php
+ * OpenAI calls made by process_request.php (and the benchmark scripts)
+ * - call_openai_chat(): one chat completion, aborted early when
+ *   $openaiAbort (a callable) returns true
+ * - openai_start() / openai_wait(): the same in the background, so a
+ *   speculative search can run while the model call is waited for
+ * - search_web_via_openai(): search model summary for the main model
+ * - grounded_reply(): search model writing the final reply fields itself
+ *
+ */
+
+include_once "includes.php";
+
+// Returns true to abort a running OpenAI transfer (process_request.php
+// sets it to turn_cancelled)
+$openaiAbort = null;
+
+// All transfers run on one curl multi handle, which every wait drives
+$openaiMulti = null;
+$openaiFinished = [];  // transfers done before they were waited for
+
+function openai_handle($API_KEY, $payload, $log_errors = 0, $log_file = 'invalid.log') {
+    global $debug, $openaiAbort;
+
+    $ch = curl_init("https://api.openai.com/v1/chat/completions");
+    if ($log_errors && $debug) {
+        // Log full outbound JSON payload
+        $toSend = json_encode($payload);
+        file_put_contents($log_file, date("[Y-m-d H:i:s]") . " OpenAI request =>\n  " . $toSend . "\n", FILE_APPEND);
+    }
+    curl_setopt_array($ch, [
+        CURLOPT_RETURNTRANSFER => true,
+        CURLOPT_POST           => true,
+        CURLOPT_HTTPHEADER     => [
+            "Content-Type: application/json",
+            "Authorization: Bearer $API_KEY"
+        ],
+        CURLOPT_POSTFIELDS     => json_encode($payload),
+        CURLOPT_TIMEOUT        => 120,
+        // Abort the transfer as soon as the client cancels the turn
+        CURLOPT_NOPROGRESS     => false,
+        CURLOPT_XFERINFOFUNCTION => function ($ch, $dlTotal, $dlNow, $ulTotal, $ulNow) use ($openaiAbort) {
+            return ($openaiAbort && $openaiAbort()) ? 1 : 0;
+        }
+    ]);
+    return $ch;
+}
+
+/**
+ * Start a chat completion in the background. Returns the transfer for
+ * openai_wait() or openai_drop().
+ */
+function openai_start($API_KEY, $payload, $log_errors = 0, $log_file = 'invalid.log') {
+    global $openaiMulti;
+
+    if ($openaiMulti === null) $openaiMulti = curl_multi_init();
+    $ch = openai_handle($API_KEY, $payload, $log_errors, $log_file);
+    curl_multi_add_handle($openaiMulti, $ch);
+    return $ch;
+}
+
+/**
+ * Wait for a started transfer, keeping the others going meanwhile.
+ * Returns [decoded response or null, error or null].
+ */
+function openai_wait($ch, $log_errors = 0, $log_file = 'invalid.log') {
+    global $debug, $openaiMulti, $openaiFinished;
+
+    $id = spl_object_id($ch);
+    $result = $openaiFinished[$id] ?? null;
+    while ($result === null) {
+        curl_multi_exec($openaiMulti, $running);
+        while ($info = curl_multi_info_read($openaiMulti)) {
+            $openaiFinished[spl_object_id($info['handle'])] = $info['result'];
+        }
+        $result = $openaiFinished[$id] ?? null;
+        if ($result === null) curl_multi_select($openaiMulti, 0.5);
+    }
+    unset($openaiFinished[$id]);
+
+    $response   = curl_multi_getcontent($ch);
+    $curl_error = ($result !== CURLE_OK) ? (curl_error($ch) ?: curl_strerror($result)) : '';
+    curl_multi_remove_handle($openaiMulti, $ch);
+    curl_close($ch);
+    if ($log_errors && $debug) {
+        // Log full raw response body
+        $respToLog = (is_string($response) ? $response : json_encode($response));
+        file_put_contents($log_file, date("[Y-m-d H:i:s]") . " OpenAI response <=\n  " . $respToLog . "\n", FILE_APPEND);
+    }
+    if ($curl_error) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " cURL error: $curl_error\n", FILE_APPEND);
+        return [null, $curl_error];
+    }
+    $data = json_decode($response, true);
+    if (!is_array($data)) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Invalid JSON from OpenAI\n" . $response . "\n\n", FILE_APPEND);
+        return [null, 'Invalid JSON response'];
+    }
+    return [$data, null];
+}
+
+/**
+ * Abandon a started transfer.
+ */
+function openai_drop($ch) {
+    global $openaiMulti, $openaiFinished;
+
+    unset($openaiFinished[spl_object_id($ch)]);
+    curl_multi_remove_handle($openaiMulti, $ch);
+    curl_close($ch);
+}
+
+function call_openai_chat($API_KEY, $payload, $log_errors = 0, $log_file = 'invalid.log') {
+    return openai_wait(openai_start($API_KEY, $payload, $log_errors, $log_file), $log_errors, $log_file);
+}
+
+function search_payload($query) {
+    return [
+        'model'    => 'gpt-4o-mini-search-preview',
+        'messages' => [
+            ['role' => 'system', 'content' => 'Perform a focused web retrieval and return a short factual summary. Include dates when relevant.'],
+            ['role' => 'user',   'content' => (string)$query],
+        ],
+    ];
+}
+
+/**
+ * Search summary from a search_payload() response.
+ */
+function search_summary($data, $err) {
+    if ($err || !isset($data['choices'][0]['message']['content'])) {
+        return 'No results found.';
+    }
+    return trim((string)$data['choices'][0]['message']['content']);
+}
+
+function search_web_via_openai($API_KEY, $query, $log_errors = 0, $log_file = 'invalid.log') {
+    global $token_id;
+
+    [$data, $err] = call_openai_chat($API_KEY, search_payload($query), $log_errors, $log_file);
+    if ($log_errors && !$err) {
+        // Log websearch
+        file_put_contents($log_file, date("[Y-m-d H:i:s]") . " OpenAI Web Search (token_id ".$token_id."):\n  {" . $query . "}\n", FILE_APPEND);
+    }
+
+    return search_summary($data, $err);
+}
+
+/**
+ * Reply fields to store from the model's text_display and text_sam, cut to
+ * the client's limits (see client_caps()). Null if a field it needs is
+ * missing.
+ */
+function reply_fields($decoded, $caps) {
+    $display = isset($decoded['text_display']) && is_string($decoded['text_display']) ? convert_ascii($decoded['text_display']) : '';
+    $sam     = isset($decoded['text_sam'])     && is_string($decoded['text_sam'])     ? convert_ascii($decoded['text_sam'])     : '';
+    if ($display === '' || ($caps['speech'] && $sam === '')) return null;
+
+    if (strlen($display) > $caps['max_reply']) $display = substr($display, 0, $caps['max_reply']);
+    return ['text_display' => $display, 'text_sam' => $caps['speech'] ? $sam : ''];
+}
+
+/**
+ * Grounded search: the search model gets the conversation and writes the
+ * reply fields itself, instead of a summary that the main model turns into
+ * the reply in another round trip.
+ */
+function grounded_payload($conversation, $query, $caps) {
+    $maxDisplay = $caps['max_reply'];
+    $speech = $caps['speech'];
+
+    $system = "You are SAM, an assistant on a FujiNet device with a " . $caps['cols'] . " column by " . $caps['rows'] . " row text screen. "
+        . "Search the web and answer the user's last message with current facts. Include dates when relevant.\n"
+        . "Reply with ONLY a single line JSON object and no other text: "
+        . ($speech ? '{"text_display":"...","text_sam":"..."}' : '{"text_display":"..."}') . "\n"
+        . "- text_display: plain ASCII, numbers as digits, " . $maxDisplay . " characters or less, no links, citations, markdown, quotation marks or slashes\n"
+        . ($speech ? "- text_sam: the same answer for speech output, numbers written as words, no special characters\n" : "");
+
+    $messages = [['role' => 'system', 'content' => $system]];
+    foreach ($conversation as $turn) {
+        if ($turn['role'] === 'user' || $turn['role'] === 'assistant') $messages[] = $turn;
+    }
+    $messages[] = ['role' => 'system', 'content' => 'Search for: ' . $query];
+
+    return [
+        'model'    => 'gpt-4o-mini-search-preview',
+        'messages' => $messages,
+    ];
+}
+
+/**
+ * Reply from a grounded_payload() response. Returns [reply fields or null,
+ * raw content]. The raw content still works as a search result if it isn't
+ * usable as a reply.
+ */
+function grounded_parse($data, $err, $caps) {
+    $content = trim((string)($data['choices'][0]['message']['content'] ?? ''));
+    if ($err || $content === '') return [null, ''];
+
+    // Search models sometimes wrap the object in prose or a code block
+    $start = strpos($content, '{');
+    $end = strrpos($content, '}');
+    $decoded = ($start !== false && $end > $start) ? json_decode(substr($content, $start, $end - $start + 1), true) : null;
+    return [is_array($decoded) ? reply_fields($decoded, $caps) : null, $content];
+}
+
+function grounded_reply($API_KEY, $conversation, $query, $caps, $log_errors = 0, $log_file = 'invalid.log') {
+    [$data, $err] = call_openai_chat($API_KEY, grounded_payload($conversation, $query, $caps), $log_errors, $log_file);
+    return grounded_parse($data, $err, $caps);
+}
+?>
@@ -0,0 +1,153 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- prompt.php
+ * The request process_request.php sends to the main model, built from the
+ * client's capabilities and the stored history. Shared with bench_prompt.php
+ * so the benchmark measures exactly what is sent.
+ * - prompt_system(): system role content
+ * - prompt_messages(): system prompt plus the history turns
+ * - prompt_functions(): web_search, get_time and compose_reply schemas
+ *
+ */
+
+include_once "includes.php";
+
+function prompt_system($caps, $maxSearches) {
+    $maxDisplay = $caps['max_reply'];
+    $speech = $caps['speech'];
+    $replyFields = $speech ? "text_display and text_sam" : "text_display";
+
+    return
+"You are SAM, a text-to-speech assistant running on a FujiNet device with access to limited tools.
+
+TOOLS YOU CAN USE:
+1) web_search — for retrieving current or factual information from the web.
+2) get_time   — for retrieving the current UTC time (you convert to the user's timezone if they ask).
+
+TO CALL A TOOL:
+When (and only when) you need to use a tool, respond with a single line JSON object and NO extra text:
+{\"action\":\"web_search\",\"query\":\"SEARCH TERMS\"}
+or
+{\"action\":\"get_time\"}
+
+CONSTRAINTS:
+- You may perform at most " . $maxSearches . " web_search actions per single user request.
+- Prefer to *not* use web search if you already have information about the request.
+- After using a tool, read the tool result (which the system will add) and continue the conversation normally.
+- Prefer concise, direct answers suitable for a " . $caps['cols'] . " column by " . $caps['rows'] . " row text screen (" . $caps['platform'] . ").
+- You may talk about any topic the end user wishes within your normal constraints
+- Your response must return " . ($speech ? "2 fields: text_display and text_sam" : "1 field: text_display") . "
+- Rules for " . ($speech ? "BOTH text_display and text_sam" : "text_display") . ": 
+  - Do NOT use any special formatting, characters, quotation marks, forward or back slashes, special symbols, or escape sequences
+  - Use periods, question or exclamation marks to end sentences
+  - Do NOT respond with Unicode characters
+- Rules only applying to text_display
+  - numbers must be printed as digits
+  - use ASCII newlines when needed
+  - limit the text_display response to " . $maxDisplay . " characters or less" . ($speech ? "
+- Rules only applying to text_sam
+  - numbers must be written as words
+  - phonetic representation of the textual reply for speech output" : "") . "
+
+WHEN YOU ARE FINISHED:
+Call the function \"compose_reply\" with the final " . $replyFields . ".";
+}
+
+/**
+ * Messages for the model: the system prompt, then the non-empty history
+ * rows (oldest first). Assistant rows are stored as reply JSON and are
+ * replayed as their text_display only.
+ */
+function prompt_messages($systemContent, $history) {
+    $messages = [
+        [
+            'role'    => 'system',
+            'content' => $systemContent
+        ]
+    ];
+
+    // Append existing (non-empty) turns
+    foreach ($history as $turn) {
+        $role = $turn['role'];
+        $c = trim((string)$turn['content']);
+        if ($c === '') continue;
+
+        // If assistant message content is JSON, extract only text_display
+        if ($role === 'assistant') {
+            $decoded = json_decode($c, true);
+            if (json_last_error() === JSON_ERROR_NONE && isset($decoded['text_display'])) {
+                $c = $decoded['text_display'];
+            }
+        }
+
+        $messages[] = [
+            'role'    => $role,
+            'content' => $c
+        ];
+    }
+    return $messages;
+}
+
+/**
+ * Functions schema: web_search(query), get_time(), and
+ * compose_reply(text_display[, text_sam]) sized to the client.
+ */
+function prompt_functions($caps) {
+    $maxDisplay = $caps['max_reply'];
+    $speech = $caps['speech'];
+
+    $replyProperties = [
+        'text_display' => [
+            'type'        => 'string',
+            'description' => 'Human-readable output limited to ' . $maxDisplay . ' characters'
+        ]
+    ];
+    if ($speech) {
+        $replyProperties['text_sam'] = [
+            'type'        => 'string',
+            'description' => 'Phonetic version of the text_display string for SAM'
+        ];
+    }
+
+    $functions = [
+        [
+            'name'        => 'web_search',
+            'description' => 'Perform a web search using a query string',
+            'parameters'  => [
+                'type'       => 'object',
+                'properties' => [
+                    'query' => [
+                        'type'        => 'string',
+                        'description' => 'Search query to look up'
+                    ]
+                ],
+                'required' => ['query']
+            ]
+        ],
+        [
+            'name'        => 'get_time',
+            'description' => 'Get the current UTC time',
+            'parameters'  => [
+                'type'       => 'object',
+                'properties' => new stdClass(),
+                'required'   => []
+            ]
+        ],
+        [
+            'name'        => 'compose_reply',
+            'description' => 'Finish by providing the text fields for the user',
+            'parameters'  => [
+                'type'       => 'object',
+                'properties' => $replyProperties,
+                'required'   => array_keys($replyProperties)
+            ]
+        ]
+    ];
+    return $functions;
+}
+?>
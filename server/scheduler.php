@@ -0,0 +1,197 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ * 
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ * 
+ * GPL v3 License
+ * ------------- scheduler.php
+ * - Admission control: at most one unanswered turn per token and at most
+ *   $maxQueuedJobs turns waiting server wide
+ * - Weighted fair queueing: every queued turn gets a virtual finish tag
+ *      tag = max(now, token's previous tag) + $jobCostSeconds / token weight
+ *   and turns start in tag order, so a token sending turns back to back
+ *   falls behind tokens that ask less often
+ * - Starts queued turns while fewer than $maxConcurrentJobs are running
+ *   (matching the OpenAI rate limits), as a process_request.php each or
+ *   by waking the worker.php processes ($workerMode)
+ *
+ * - Turns running longer than $jobTimeoutSeconds are answered with an
+ *   error (scheduler_expire())
+ *
+ * Assistant rows with status = 1 are unanswered turns. started_at IS NULL
+ * means the turn is still queued. Cancelled turns have status = 2 and
+ * are neither started nor counted.
+ */
+
+include_once "includes.php";
+
+/**
+ * Decide whether a token may submit a new turn.
+ * Returns null if it may, otherwise [http code, response fields].
+ */
+function scheduler_admit($pdo, $token_key)
+{
+    global $maxQueuedJobs, $jobTimeoutSeconds;
+
+    $stmt = db_prepare($pdo,
+        "SELECT id
+           FROM messages
+          WHERE token_id = ?
+            AND role = 'assistant'
+            AND status = 1
+            AND created_at > " . sql_seconds_ago() . "
+          LIMIT 1"
+    );
+    $stmt->execute([$token_key, (int)$jobTimeoutSeconds]);
+    $inFlight = db_row($stmt);
+    if ($inFlight) {
+        return [409, [
+            "message_id" => $inFlight['id'],
+            "error"      => "Request already in progress"
+        ]];
+    }
+
+    $stmt = db_prepare($pdo, "SELECT COUNT(*) FROM messages WHERE status = 1 AND started_at IS NULL");
+    $stmt->execute();
+    if ((int)db_value($stmt) >= $maxQueuedJobs) {
+        return [503, ["error" => "Server busy, try again later"]];
+    }
+
+    return null;
+}
+
+/**
+ * Move a token's fair queueing tag on for a new turn. The assistant row
+ * takes the token's vfinish as its sched_tag when it is inserted.
+ */
+function scheduler_enqueue($pdo, $token_key)
+{
+    global $jobCostSeconds;
+
+    $stmt = db_prepare($pdo,
+        "UPDATE tokens
+            SET vfinish = GREATEST(vfinish, ?) + ? / GREATEST(weight, 1)
+          WHERE token_id = ?"
+    );
+    $stmt->execute([microtime(true), (float)$jobCostSeconds, $token_key]);
+}
+
+/**
+ * Give up on turns that have been running longer than $jobTimeoutSeconds:
+ * their worker has most likely died. They get an error reply and are
+ * published complete, so the client stops waiting.
+ */
+function scheduler_expire($pdo)
+{
+    global $jobTimeoutSeconds, $log_errors, $log_file;
+
+    $stmt = db_prepare($pdo,
+        "SELECT id, token_id
+           FROM messages
+          WHERE status = 1
+            AND started_at <= " . sql_seconds_ago() . "
+          LIMIT 20"
+    );
+    $stmt->execute([(int)$jobTimeoutSeconds]);
+    $expired = $stmt->fetchAll();
+
+    $reply = json_encode(['text_display' => "Error: the request timed out.", 'text_sam' => 'Error']);
+    foreach ($expired as $turn) {
+        $stmt = db_prepare($pdo, "UPDATE messages SET content = ?, status = 0 WHERE id = ? AND status = 1");
+        $stmt->execute([$reply, $turn['id']]);
+        if ($stmt->rowCount() === 0) continue;
+
+        status_cache_set($turn['id'], $turn['token_id'], "complete");
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Timed out message {$turn['id']}\n", FILE_APPEND);
+    }
+}
+
+/**
+ * Mark the next queued turn started if there is capacity and return its
+ * id and token_id, or null. Callers hold the 'ai_sam_dispatch' lock
+ * (db_lock()), which keeps concurrent callers from overshooting the limit.
+ */
+function scheduler_next($pdo)
+{
+    global $maxConcurrentJobs, $jobTimeoutSeconds;
+
+    scheduler_expire($pdo);
+    while (true) {
+        // Turns running longer than the timeout have most likely died
+        $stmt = db_prepare($pdo,
+            "SELECT COUNT(*)
+               FROM messages
+              WHERE status = 1
+                AND started_at > " . sql_seconds_ago()
+        );
+        $stmt->execute([(int)$jobTimeoutSeconds]);
+        if ((int)db_value($stmt) >= $maxConcurrentJobs) return null;
+
+        $stmt = db_prepare($pdo,
+            "SELECT id, token_id
+               FROM messages
+              WHERE status = 1
+                AND started_at IS NULL
+           ORDER BY sched_tag, id
+              LIMIT 1"
+        );
+        $stmt->execute();
+        $next = db_row($stmt);
+        if (!$next) return null;
+
+        $stmt = db_prepare($pdo, "UPDATE messages SET started_at = NOW(6) WHERE id = ? AND status = 1 AND started_at IS NULL");
+        $stmt->execute([$next['id']]);
+        if ($stmt->rowCount() === 0) continue;
+
+        status_cache_set($next['id'], $next['token_id'], "running");
+        return $next;
+    }
+}
+
+/**
+ * Start queued turns while there is capacity. With $workerMode "daemon"
+ * the worker.php processes take the turns themselves and are only woken.
+ */
+function scheduler_dispatch($pdo)
+{
+    global $workerMode, $log_errors, $log_file;
+
+    if ($workerMode === "daemon") {
+        worker_notify();
+        return;
+    }
+
+    if (!db_lock($pdo, 'ai_sam_dispatch', 2)) return;
+
+    try {
+        while ($next = scheduler_next($pdo)) {
+            $jobId = (int)$next['id'];
+            exec("php process_request.php $jobId > /dev/null 2>&1 &");
+            if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Dispatched message $jobId\n", FILE_APPEND);
+        }
+    } finally {
+        db_unlock($pdo, 'ai_sam_dispatch');
+    }
+}
+
+/**
+ * 1-based position of a queued turn, or 0 once it has started.
+ */
+function scheduler_queue_position($pdo, $message_id)
+{
+    $stmt = db_prepare($pdo,
+        "SELECT COUNT(q.id)
+           FROM messages AS m
+           JOIN messages AS q
+             ON q.status = 1
+            AND q.started_at IS NULL
+            AND (q.sched_tag < m.sched_tag OR (q.sched_tag = m.sched_tag AND q.id <= m.id))
+          WHERE m.id = ?
+            AND m.status = 1
+            AND m.started_at IS NULL"
+    );
+    $stmt->execute([$message_id]);
+    return (int)db_value($stmt);
+}
+?>
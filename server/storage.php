@@ -0,0 +1,250 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- storage.php
+ * Database access for the two supported backends, chosen with $dbDriver:
+ * - "mysql": MySQL / MariaDB with the schema in ai-sam-db.sql
+ * - "sqlite": one SQLite file ($sqlitePath) in WAL mode, for single host
+ *   installs and load tests without a database server. The schema in
+ *   ai-sam-db-sqlite.sql is created on first use.
+ * The queries elsewhere are written to run on both. The few places where
+ * the dialects differ go through the functions below, and on SQLite the
+ * MySQL functions NOW() and GREATEST() are provided in PHP.
+ *
+ */
+
+include_once "includes.php";
+
+$dbLockFiles = [];  // lock files held by db_lock() on SQLite
+$dbStatements = []; // statements prepared by db_prepare() on the current connection
+
+/**
+ * Connect to the database, once per process. Persistent connections let the
+ * web server reuse the MySQL connection between requests instead of
+ * reconnecting every poll. Long running CLI processes (gateway.php) use a
+ * plain connection and pass $reconnect after it failed.
+ */
+function db_connect($reconnect = false)
+{
+    global $dbDriver, $dbStatements;
+    static $pdo = null;
+
+    if ($pdo !== null && !$reconnect) return $pdo;
+    $pdo = null;
+    $dbStatements = [];
+
+    $pdo = ($dbDriver === "sqlite") ? db_open_sqlite() : db_open_mysql();
+    return $pdo;
+}
+
+function db_open_mysql()
+{
+    global $dbhost, $dbuser, $dbpass, $dbname;
+
+    $dsn = "mysql:host={$dbhost};dbname={$dbname};charset=utf8mb4";
+    return new PDO($dsn, $dbuser, $dbpass, [
+        PDO::ATTR_ERRMODE            => PDO::ERRMODE_EXCEPTION,
+        PDO::ATTR_DEFAULT_FETCH_MODE => PDO::FETCH_ASSOC,
+        PDO::ATTR_PERSISTENT         => PHP_SAPI !== 'cli',
+        // rowCount() of an UPDATE counts matched rows, not changed rows
+        PDO::MYSQL_ATTR_FOUND_ROWS   => true,
+    ]);
+}
+
+/**
+ * Open the SQLite file. Opening a file is cheap, so there is no persistent
+ * connection. rowCount() of an UPDATE already counts matched rows.
+ */
+function db_open_sqlite()
+{
+    global $sqlitePath;
+
+    $create = !file_exists($sqlitePath);
+    $pdo = new PDO("sqlite:" . $sqlitePath, null, null, [
+        PDO::ATTR_ERRMODE            => PDO::ERRMODE_EXCEPTION,
+        PDO::ATTR_DEFAULT_FETCH_MODE => PDO::FETCH_ASSOC,
+        PDO::ATTR_TIMEOUT            => 5,   // busy timeout while another process writes
+    ]);
+
+    // WAL lets the polls read while a worker writes. NORMAL sync is safe in
+    // WAL mode and only risks the last commits on power loss.
+    $pdo->exec("PRAGMA journal_mode = WAL");
+    $pdo->exec("PRAGMA synchronous = NORMAL");
+    $pdo->exec("PRAGMA temp_store = MEMORY");
+
+    // Times are kept in UTC, like SQLite's own CURRENT_TIMESTAMP. NOW(6)
+    // gives milliseconds, the precision of strftime('%f') in the schema
+    // defaults, so all stored times have the same format.
+    $pdo->sqliteCreateFunction('NOW', function ($precision = 0) {
+        return (new DateTime("now", new DateTimeZone("UTC")))->format($precision ? "Y-m-d H:i:s.v" : "Y-m-d H:i:s");
+    });
+    $pdo->sqliteCreateFunction('GREATEST', 'max');
+
+    if ($create) $pdo->exec(file_get_contents(__DIR__ . "/ai-sam-db-sqlite.sql"));
+    return $pdo;
+}
+
+/**
+ * Prepare a statement once per connection and hand back the same one on
+ * later calls. The long running processes (gateway.php, worker.php) run
+ * the same few queries for every request.
+ */
+function db_prepare($pdo, $sql)
+{
+    global $dbStatements;
+
+    if (!isset($dbStatements[$sql])) {
+        $dbStatements[$sql] = $pdo->prepare($sql);
+    } else {
+        $dbStatements[$sql]->closeCursor();
+    }
+    return $dbStatements[$sql];
+}
+
+/**
+ * First row of an executed statement, or false, with the cursor closed
+ * right away. On SQLite an open SELECT keeps its read transaction, so a
+ * long running process would go on reading an old snapshot and could not
+ * start writing.
+ */
+function db_row($stmt)
+{
+    $row = $stmt->fetch();
+    $stmt->closeCursor();
+    return $row;
+}
+
+/**
+ * First column of the first row, or false, with the cursor closed.
+ */
+function db_value($stmt)
+{
+    $value = $stmt->fetchColumn();
+    $stmt->closeCursor();
+    return $value;
+}
+
+/**
+ * SQL for the time $seconds ago, with the seconds as a ? placeholder.
+ */
+function sql_seconds_ago()
+{
+    global $dbDriver;
+
+    if ($dbDriver === "sqlite")
+        return "strftime('%Y-%m-%d %H:%M:%f', 'now', '-' || ? || ' seconds')";
+    return "NOW(6) - INTERVAL ? SECOND";
+}
+
+/**
+ * Create the tokens row or record activity on it.
+ */
+function db_touch_token($pdo, $token_key)
+{
+    global $dbDriver;
+
+    if ($dbDriver === "sqlite") {
+        $stmt = db_prepare($pdo,
+            "INSERT INTO tokens (token_id) VALUES (?)
+             ON CONFLICT (token_id) DO UPDATE SET last_activity_at = NOW(6)"
+        );
+    } else {
+        $stmt = db_prepare($pdo,
+            "INSERT INTO tokens (token_id) VALUES (?)
+             ON DUPLICATE KEY UPDATE last_activity_at = CURRENT_TIMESTAMP(6)"
+        );
+    }
+    $stmt->execute([$token_key]);
+}
+
+/**
+ * Record a revoked signed token. $stateDir only holds revocations until the
+ * next reboot (tmpfs), the table keeps them until cleanup drops them once
+ * the token would have expired anyway.
+ */
+function db_revoke_token($pdo, $token_key)
+{
+    global $dbDriver;
+
+    $stmt = db_prepare($pdo, ($dbDriver === "sqlite" ? "INSERT OR IGNORE" : "INSERT IGNORE") . " INTO revoked_tokens (token_id) VALUES (?)");
+    $stmt->execute([$token_key]);
+}
+
+function db_token_revoked($pdo, $token_key)
+{
+    $stmt = db_prepare($pdo, "SELECT 1 FROM revoked_tokens WHERE token_id = ?");
+    $stmt->execute([$token_key]);
+    return db_value($stmt) !== false;
+}
+
+/**
+ * Insert a turn: the user's message and the pending assistant row, which
+ * gets the token's fair queueing tag (see scheduler_enqueue()). One
+ * statement, and only if the token row exists. Returns the assistant row
+ * id, or null without a token row.
+ */
+function db_insert_turn($pdo, $token_key, $message, $idem_key, $caps)
+{
+    $stmt = db_prepare($pdo,
+        "INSERT INTO messages (token_id, role, content, status, idem_key, caps, sched_tag)
+         SELECT token_id, 'user', ?, 0, NULL, NULL, NULL FROM tokens WHERE token_id = ?
+          UNION ALL
+         SELECT token_id, 'assistant', '', 1, ?, ?, vfinish FROM tokens WHERE token_id = ?"
+    );
+    $stmt->execute([$message, $token_key, $idem_key, $caps, $token_key]);
+    if ($stmt->rowCount() !== 2) return null;
+
+    // lastInsertId() of a multi-row insert is the first row on MySQL and the
+    // last on SQLite, so look the assistant row up
+    $stmt = db_prepare($pdo, "SELECT MAX(id) FROM messages WHERE token_id = ? AND role = 'assistant'");
+    $stmt->execute([$token_key]);
+    return (string)db_value($stmt);
+}
+
+/**
+ * Named lock between processes, waiting up to $timeout seconds.
+ * MySQL has GET_LOCK(); for SQLite, where all processes are on one host,
+ * a lock file in $stateDir does the same.
+ */
+function db_lock($pdo, $name, $timeout)
+{
+    global $dbDriver, $stateDir, $dbLockFiles;
+
+    if ($dbDriver !== "sqlite")
+        return (int)$pdo->query("SELECT GET_LOCK(" . $pdo->quote($name) . ", " . (int)$timeout . ")")->fetchColumn() === 1;
+
+    if (!is_dir($stateDir)) @mkdir($stateDir, 0700, true);
+    $fp = @fopen($stateDir . "/" . $name . ".lock", "c");
+    if ($fp === false) return false;
+
+    $deadline = microtime(true) + $timeout;
+    while (!flock($fp, LOCK_EX | LOCK_NB)) {
+        if (microtime(true) >= $deadline) {
+            fclose($fp);
+            return false;
+        }
+        usleep(20000);
+    }
+    $dbLockFiles[$name] = $fp;
+    return true;
+}
+
+function db_unlock($pdo, $name)
+{
+    global $dbDriver, $dbLockFiles;
+
+    if ($dbDriver !== "sqlite") {
+        $pdo->query("SELECT RELEASE_LOCK(" . $pdo->quote($name) . ")");
+        return;
+    }
+    if (isset($dbLockFiles[$name])) {
+        flock($dbLockFiles[$name], LOCK_UN);
+        fclose($dbLockFiles[$name]);
+        unset($dbLockFiles[$name]);
+    }
+}
+?>
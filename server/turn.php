@@ -0,0 +1,248 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- turn.php
+ * Helpers for answering one turn, used by process_request.php. They are
+ * kept apart so worker.php can run process_request.php again and again
+ * in one process.
+ * - turn_end(): leaves the turn, by exiting or, in a worker, by throwing
+ *   TurnEnd back to the worker loop
+ * - cancel checks, storing the reply, tool JSON parsing, search steps
+ *   and history pruning
+ *
+ */
+
+include_once "includes.php";
+include_once "cleanup.php";
+include_once "scheduler.php";
+include_once "openai.php";
+include_once "prompt.php";
+
+// OpenAI calls stop as soon as the client cancels the turn
+$openaiAbort = 'turn_cancelled';
+
+class TurnEnd extends Exception {}
+
+/**
+ * The turn is over. A speculative search still running is dropped, so a
+ * worker doesn't carry it into the next turn.
+ */
+function turn_end() {
+    global $speculation;
+
+    if ($speculation) {
+        openai_drop($speculation);
+        $speculation = null;
+    }
+    if (defined('AI_SAM_WORKER')) throw new TurnEnd();
+    exit;
+}
+
+/**
+ * Leave a turn that could not be run, handing its slot to the next turn.
+ * The row itself is answered with an error once it times out (see
+ * scheduler_expire()).
+ */
+function exit_unstarted($pdo = null) {
+    try {
+        scheduler_dispatch($pdo ?? db_connect());
+    } catch (PDOException $e) {
+        // Nothing can be started without the database
+    }
+    turn_end();
+}
+
+/**
+ * True once the client cancelled this turn. cancel_request.php publishes it
+ * to the status cache, which is read at most once a second.
+ */
+function turn_cancelled() {
+    global $id;
+    static $cancelled = false, $lastCheck = 0, $checked = null;
+
+    // A worker runs many turns, start over for each
+    if ($checked !== $id) {
+        $checked = $id;
+        $cancelled = false;
+        $lastCheck = 0;
+    }
+    if ($cancelled) return true;
+    $now = microtime(true);
+    if ($now - $lastCheck < 1) return false;
+    $lastCheck = $now;
+
+    $cached = status_cache_get($id);
+    $cancelled = $cached && $cached['s'] === 'cancelled';
+    return $cancelled;
+}
+
+/**
+ * Leave without an answer after a cancel, handing the slot to the next turn.
+ */
+function exit_cancelled($pdo) {
+    global $id, $log_errors, $log_file;
+
+    if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Aborted cancelled message $id\n", FILE_APPEND);
+    scheduler_dispatch($pdo);
+    cleanup_tick($pdo);
+    turn_end();
+}
+
+/**
+ * Store the reply unless the turn was cancelled meanwhile.
+ */
+function store_reply($pdo, $content) {
+    global $id, $token_id;
+
+    $stmt = db_prepare($pdo, "UPDATE messages SET content=?, status=0 WHERE id=? AND status=1");
+    $stmt->execute([$content, $id]);
+    if ($stmt->rowCount() === 0) exit_cancelled($pdo);
+    status_cache_set($id, $token_id, "complete");
+}
+
+function get_current_utc() {
+    return gmdate('Y-m-d H:i:s') . ' UTC';
+}
+
+function parse_tool_json_if_valid($text) {
+    if (!is_string($text)) return null;
+    if (strpos($text, "\n") !== false) return null; // must be single line
+    $trim = trim($text);
+    if ($trim === '') return null;
+    if ($trim[0] !== '{' || substr($trim, -1) !== '}') return null;
+    $obj = json_decode($trim, true);
+    if (!is_array($obj)) return null;
+    if (!isset($obj['action'])) return null;
+    $action = $obj['action'];
+    if ($action !== 'web_search' && $action !== 'get_time') return null;
+    if ($action === 'web_search' && !isset($obj['query'])) return null;
+    if ($action === 'web_search' && !is_string($obj['query'])) return null;
+    return ['action' => $action, 'query' => $obj['query'] ?? null, 'raw' => $trim];
+}
+
+/**
+ * Whether the question is likely to need a web search: it matches
+ * $speculativeSearchPattern, or it is a short follow-up ("and tomorrow?")
+ * to a question that did.
+ */
+function search_predicted($messages) {
+    global $speculativeSearchPattern;
+
+    $questions = [];
+    foreach ($messages as $m) {
+        if ($m['role'] === 'user') $questions[] = $m['content'];
+    }
+    $n = count($questions);
+    if ($n === 0) return false;
+    if (preg_match($speculativeSearchPattern, $questions[$n - 1])) return true;
+    return $n > 1 && str_word_count($questions[$n - 1]) <= 6 && preg_match($speculativeSearchPattern, $questions[$n - 2]);
+}
+
+/**
+ * Take one of the $maxSpeculativeSearchesPerMinute shared by all workers.
+ * The count lives in $stateDir as "minute count".
+ */
+function speculation_allowed() {
+    global $stateDir, $maxSpeculativeSearchesPerMinute;
+
+    if ($maxSpeculativeSearchesPerMinute <= 0) return false;
+    if (!is_dir($stateDir)) @mkdir($stateDir, 0700, true);
+    $fp = @fopen($stateDir . "/speculation", "c+");
+    if ($fp === false) return false;
+
+    flock($fp, LOCK_EX);
+    $minute = intdiv(time(), 60);
+    $parts = explode(" ", trim((string)stream_get_contents($fp)));
+    $count = ((int)$parts[0] === $minute) ? (int)($parts[1] ?? 0) : 0;
+    $allowed = $count < $maxSpeculativeSearchesPerMinute;
+    if ($allowed) {
+        ftruncate($fp, 0);
+        rewind($fp);
+        fwrite($fp, $minute . " " . ($count + 1));
+    }
+    flock($fp, LOCK_UN);
+    fclose($fp);
+    return $allowed;
+}
+
+/**
+ * Store the reply and leave, starting the next queued turn.
+ */
+function finish_turn($pdo, $replyArr) {
+    global $token_id, $historyLimit, $log_errors, $log_file;
+
+    store_reply($pdo, json_encode($replyArr));
+    if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Minimal Response:\n  " . json_encode($replyArr) . "\n", FILE_APPEND);
+    prune_msgs($pdo, $token_id, $historyLimit, $log_errors ?? 0, $log_file ?? 'invalid.log');
+    scheduler_dispatch($pdo);
+    cleanup_tick($pdo);
+    turn_end();
+}
+
+/**
+ * Run a web_search the model asked for ($toolJson is the request as tool
+ * JSON). With $groundedSearch the first search of the turn goes straight
+ * to grounded_reply(), which ends the turn if its answer is usable.
+ * Otherwise the search result is added for the next model step. A
+ * speculative search already running stands in for the first search.
+ */
+function web_search_step($query, $toolJson) {
+    global $pdo, $API_KEY, $messages, $caps, $searchCount, $maxSearches, $groundedSearch, $speculation, $log_errors, $log_file;
+
+    $searchCount++;
+    if ($searchCount > $maxSearches) {
+        $messages[] = ['role' => 'assistant', 'content' => $toolJson];
+        $messages[] = ['role' => 'system', 'content' => 'Search limit reached. Answer using what you already know.'];
+        return;
+    }
+
+    $result = '';
+    if ($searchCount === 1 && $speculation) {
+        [$data, $err] = openai_wait($speculation, $log_errors, $log_file);
+        $speculation = null;
+        if (turn_cancelled()) exit_cancelled($pdo);
+        if ($groundedSearch) {
+            [$reply, $result] = grounded_parse($data, $err, $caps);
+            if ($reply) finish_turn($pdo, $reply);
+        } elseif (!$err) {
+            $result = search_summary($data, $err);
+        }
+    } elseif ($groundedSearch && $searchCount === 1) {
+        [$reply, $result] = grounded_reply($API_KEY, $messages, $query, $caps, $log_errors, $log_file);
+        if (turn_cancelled()) exit_cancelled($pdo);
+        if ($reply) finish_turn($pdo, $reply);
+    }
+    if ($result === '') $result = search_web_via_openai($API_KEY, $query, $log_errors, $log_file);
+
+    $messages[] = ['role' => 'assistant', 'content' => $toolJson];
+    $messages[] = ['role' => 'system', 'content' => 'Search result: ' . $result];
+}
+
+/**
+ * Prune oldest messages for a token so only the most recent $historyLimit remain
+ */
+function prune_msgs($pdo, $token_id, $historyLimit, $log_errors = 0, $log_file = 'invalid.log') {
+    try {
+        $stmt = $pdo->prepare("SELECT id FROM messages WHERE token_id = ? ORDER BY created_at ASC, id ASC");
+        $stmt->execute([$token_id]);
+        $ids = $stmt->fetchAll(PDO::FETCH_COLUMN, 0);
+        $total = is_array($ids) ? count($ids) : 0;
+        $excess = $total - (int)$historyLimit;
+        if ($excess > 0) {
+            $toDelete = array_slice($ids, 0, $excess);
+            $placeholders = implode(',', array_fill(0, count($toDelete), '?'));
+            $del = $pdo->prepare("DELETE FROM messages WHERE id IN ($placeholders)");
+            $del->execute($toDelete);
+            if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Pruned " . count($toDelete) . " old messages for token $token_id
+", FILE_APPEND);
+        }
+    } catch (Throwable $e) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " prune_msgs error: " . $e->getMessage() . "
+", FILE_APPEND);
+    }
+}
+?>
@@ -0,0 +1,102 @@
+<?php
+/*
+ * OpenAI Proxy Server with context window and web search for FujiNet AI SAM App
+ *
+ * Copyright (c) 2025 Joe Honold, mozzwald <gmail.com>
+ *
+ * GPL v3 License
+ * ------------- worker.php
+ * Long running worker for $workerMode = "daemon", run from the CLI
+ * (php worker.php), $maxConcurrentJobs of them side by side:
+ * - Takes the next queued turn (scheduler_next()) and answers it with
+ *   process_request.php in this process, so a turn starts without a new
+ *   PHP process and reuses the database connection and its statements
+ * - Sleeps on its own datagram socket ($stateDir/workers/PID.sock) while
+ *   the queue is empty. scheduler_dispatch() wakes the workers when a turn
+ *   is queued (worker_notify()), and the queue is looked at every
+ *   WORKER_IDLE_SECONDS anyway
+ * - Exits after WORKER_MAX_TURNS turns to hand back memory; run it under
+ *   a supervisor (systemd, supervisord) that starts it again
+ *
+ */
+
+if (PHP_SAPI !== 'cli') exit;
+
+define('AI_SAM_WORKER', true);
+define('WORKER_IDLE_SECONDS', 5);
+define('WORKER_MAX_TURNS', 500);
+
+include_once "turn.php";
+
+// Relative paths ($log_file, process_request.php) as for the web scripts
+chdir(__DIR__);
+
+$workerDir = $stateDir . "/workers";
+if (!is_dir($workerDir)) @mkdir($workerDir, 0700, true);
+$wakePath = $workerDir . "/" . getmypid() . ".sock";
+@unlink($wakePath);
+$wake = @stream_socket_server("udg://" . $wakePath, $errno, $errstr, STREAM_SERVER_BIND);
+if ($wake === false) {
+    fwrite(STDERR, "worker: cannot bind $wakePath: $errstr\n");
+    exit(1);
+}
+stream_set_blocking($wake, false);
+register_shutdown_function(function () use ($wakePath) {
+    @unlink($wakePath);
+});
+
+if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Worker " . getmypid() . " started\n", FILE_APPEND);
+
+$turns = 0;
+while ($turns < WORKER_MAX_TURNS) {
+    $workerJob = null;
+    try {
+        $pdo = db_connect();
+        if (db_lock($pdo, 'ai_sam_dispatch', 2)) {
+            try {
+                $next = scheduler_next($pdo);
+            } finally {
+                db_unlock($pdo, 'ai_sam_dispatch');
+            }
+            if ($next) $workerJob = (int)$next['id'];
+        }
+    } catch (PDOException $e) {
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Worker database error: " . $e->getMessage() . "\n", FILE_APPEND);
+        try {
+            db_connect(true);
+        } catch (PDOException $e) {
+            sleep(WORKER_IDLE_SECONDS);
+        }
+        continue;
+    }
+
+    if ($workerJob === null) {
+        $read = [$wake];
+        $write = $except = null;
+        if (@stream_select($read, $write, $except, WORKER_IDLE_SECONDS)) {
+            while (($data = @stream_socket_recvfrom($wake, 32)) !== false && $data !== "");
+        }
+        continue;
+    }
+
+    // At global scope, like a process of its own
+    if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Worker " . getmypid() . " took message $workerJob\n", FILE_APPEND);
+    try {
+        include "process_request.php";
+    } catch (TurnEnd $e) {
+        // Finished, cancelled or failed; the turn has been handed on
+    } catch (Throwable $e) {
+        // The row stays running and is given up after $jobTimeoutSeconds,
+        // as if its process had died
+        if ($log_errors) file_put_contents($log_file, date("[Y-m-d H:i:s]") . " Worker error on message $workerJob: " . $e->getMessage() . "\n", FILE_APPEND);
+        if ($speculation ?? null) openai_drop($speculation);
+        $speculation = null;
+        try {
+            db_connect(true);
+        } catch (PDOException $e) {
+            // Tried again with the next turn
+        }
+    }
+    $turns++;
+}
+?>
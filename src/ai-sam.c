@@ -1,23 +1,71 @@
 #include "ai-sam.h"
 #include "config.h"  // PROXY_API_URL and DEFAULT_TOKEN definitions
 #include "speech.h"
+#include "screen.h"
+#include "cache.h"
 
 static char app_token[65] = {0};
 
-// Global buffers
-char response_buffer[RESPONSE_BUFFER_SIZE];
-char devicespec[256];
-char json_payload[REQUEST_BUFFER_SIZE];
-char user_input[512];
-char escaped_input[768];
-char text_display[MAX_TEXT_SIZE] = "";
-#ifdef BUILD_ATARI
-char text_sam[MAX_TEXT_SIZE] = "";
+// Idempotency key of the current question. It is kept while the question
+// is unanswered so retrying the same text doesn't start a second request.
+// turn_seq starts over every run, so the key leads with the run count kept
+// in the RUN_KEY_ID appkey.
+static char turn_key[18] = "";
+static uint16_t turn_run = 0;
+static uint16_t turn_seq = 0;
+static uint16_t turn_sum = 0;
+static bool turn_open = false;
+
+// message_id of a question whose answer hasn't been seen yet. It is kept in
+// the PENDING_KEY_ID appkey, so it survives a timeout or a restart.
+static bool pending = false;
+// The last poll didn't get an answer from the server at all
+static bool poll_failed = false;
+
+enum
+{
+    REPLY_DONE,
+    REPLY_WAITING,
+    REPLY_FAILED
+};
+static uint8_t wait_for_reply(int timeout);
+static bool check_pending(void);
+static void show_reply(void);
+
+#ifdef REPLY_CACHE
+// How far back the last BACK/REPLAY went, 0 being the newest reply
+static uint8_t replay_back = 0;
 #endif
+
+// Global buffers
+char arena[ARENA_SIZE];
 bool speak = true;
 char message_id[64] = "";
 char status[32] = "";
 
+// ---------------------------------------------------------------------------
+// Buffer arena phases (see arena.h)
+// ---------------------------------------------------------------------------
+void arena_enter(uint8_t phase)
+{
+    // Regions shared with an earlier phase hold stale data, start them empty
+    switch (phase)
+    {
+    case PHASE_INPUT:
+        USER_INPUT[0] = '\0';
+        break;
+    case PHASE_REQUEST:
+        JSON_PAYLOAD[0] = '\0';
+        break;
+    case PHASE_POLL:
+        RESPONSE_BUFFER[0] = '\0';
+        TEXT_DISPLAY[0] = '\0';
+        break;
+    case PHASE_RENDER:
+        break;
+    }
+}
+
 // ---------------------------------------------------------------------------
 // FujiNet initialization and session handling
 // ---------------------------------------------------------------------------
@@ -29,17 +77,35 @@ bool init_fujinet(void)
 
     if (!fuji_get_adapter_config(&config))
     {
-        printf("Error: FujiNet not detected or failed to retrieve configuration!\n");
+        out_str("Error: FujiNet not detected or failed to retrieve configuration!\n");
         return false;
     }
 
     fuji_set_appkey_details(CREATOR_ID, APP_ID, DEFAULT);
 
+    if (fuji_read_appkey(RUN_KEY_ID, &count, buffer) && count > 0 && count < 6)
+    {
+        buffer[count] = '\0';
+        turn_run = (uint16_t)atoi((char*)buffer);
+    }
+    turn_run++;
+    str_fmt((char*)buffer, sizeof(buffer), "%u", turn_run);
+    fuji_write_appkey(RUN_KEY_ID, (uint16_t)strlen((char*)buffer), buffer);
+
     if (fuji_read_appkey(TOKEN_KEY_ID, &count, buffer))
     {
         if (count > 64) count = 64;
         buffer[count] = '\0';
         strncpy(app_token, (char*)buffer, sizeof(app_token) - 1);
+
+        // A question from the last run that was never answered
+        if (fuji_read_appkey(PENDING_KEY_ID, &count, buffer) && count > 0)
+        {
+            if (count > 63) count = 63;
+            buffer[count] = '\0';
+            strcpy(message_id, (char*)buffer);
+            pending = true;
+        }
         return true;
     }
     else
@@ -50,80 +116,96 @@ bool init_fujinet(void)
     }
 }
 
+static void pending_save(void)
+{
+    pending = fuji_write_appkey(PENDING_KEY_ID, (uint16_t)strlen(message_id), (uint8_t*)message_id);
+}
+
+static void pending_clear(void)
+{
+    if (pending)
+    {
+        fuji_write_appkey(PENDING_KEY_ID, 0, (uint8_t*)"");
+        pending = false;
+    }
+}
+
 bool new_convo(void)
 {
     int err, len;
+    json_writer json;
 
-    printf("Starting new session...");
-    snprintf(devicespec, sizeof(devicespec), "N1:%s%s", PROXY_API_URL, SUBMIT_URL);
+    out_str("Starting new session...");
+    url_build(SUBMIT_URL);
 
-    snprintf(json_payload, REQUEST_BUFFER_SIZE,
-        "{"
-        "\"token_id\":\"%s\","
-        "\"new\":\"%s\""
-        "}",
-        app_token, DEFAULT_TOKEN);
+    json_begin(&json, JSON_PAYLOAD, REQUEST_BUFFER_SIZE);
+    json_add_string(&json, "token_id", app_token);
+    json_add_string(&json, "new", DEFAULT_TOKEN);
+    json_end(&json);
 
-    err = network_open(devicespec, OPEN_MODE_HTTP_POST, OPEN_TRANS_NONE);
+    err = network_open(DEVICESPEC, OPEN_MODE_HTTP_POST, OPEN_TRANS_NONE);
     if (err != 0)
     {
-        printf("\nErr: Unable to open network channel.\n");
+        out_str("\nErr: Unable to open network channel.\n");
         return false;
     }
 
-    network_http_start_add_headers(devicespec);
-    network_http_add_header(devicespec, "Content-Type: application/json");
-    network_http_end_add_headers(devicespec);
+    network_http_start_add_headers(DEVICESPEC);
+    network_http_add_header(DEVICESPEC, "Content-Type: application/json");
+    network_http_end_add_headers(DEVICESPEC);
 
-    err = network_http_post(devicespec, json_payload);
+    err = network_http_post(DEVICESPEC, JSON_PAYLOAD);
     if (err != 0)
     {
-        printf("\nErr: Failed to send data.\n");
-        network_close(devicespec);
+        out_str("\nErr: Failed to send data.\n");
+        network_close(DEVICESPEC);
         return false;
     }
 
-    err = network_json_parse(devicespec);
+    err = network_json_parse(DEVICESPEC);
     if (err != 0)
     {
-        printf("\nErr: Failed to parse JSON.\n");
-        network_close(devicespec);
+        out_str("\nErr: Failed to parse JSON.\n");
+        network_close(DEVICESPEC);
         return false;
     }
 
-    err = network_json_query(devicespec, "/token_id", response_buffer);
+    err = network_json_query(DEVICESPEC, "/token_id", RESPONSE_BUFFER);
     if (err > 0)
     {
-        strncpy(app_token, response_buffer, sizeof(app_token) - 1);
+        strncpy(app_token, RESPONSE_BUFFER, sizeof(app_token) - 1);
     }
     else
     {
-        printf("\nError: Token not received.\n");
-        network_close(devicespec);
+        out_str("\nError: Token not received.\n");
+        network_close(DEVICESPEC);
         return false;
     }
 
-    network_close(devicespec);
+    network_close(DEVICESPEC);
 
-    // printf("TokResp (%d): %s\n", sizeof(response_buffer), response_buffer); // Print response for debug
-    len = strlen(response_buffer);
+    // printf("TokResp (%d): %s\n", sizeof(RESPONSE_BUFFER), RESPONSE_BUFFER); // Print response for debug
+    len = strlen(RESPONSE_BUFFER);
     if (len > 64) {
         len = 64;
     }
 
-    // Copy token from response_buffer into app_token
-    strncpy(app_token, response_buffer, len);
-    app_token[len+1] = '\0';
+    // Copy token from RESPONSE_BUFFER into app_token
+    strncpy(app_token, RESPONSE_BUFFER, len);
+    app_token[len] = '\0';
     // Write it to AppKey and update in-memory
     if (!fuji_write_appkey(TOKEN_KEY_ID, (uint16_t)len, (uint8_t*)app_token))
     {
-        printf("\nErr: Failed to write token to AppKey.\n");
+        out_str("\nErr: Failed to write token to AppKey.\n");
         return false;
     }
     else
     {
         //printf("Token saved: \n %s\n", app_token);
-        printf("done!\n");
+        out_str("done!\n");
+
+        // Messages of the old token are gone
+        pending_clear();
         return true;
     }
 }
@@ -131,62 +213,117 @@ bool new_convo(void)
 // ---------------------------------------------------------------------------
 // Send request asynchronously to submit_request.php
 // ---------------------------------------------------------------------------
-bool send_openai_request(char *user_input)
+static uint16_t input_checksum(const char *text)
+{
+    uint16_t sum = 0;
+    while (*text)
+    {
+        sum = (sum << 5) + sum + (unsigned char)*text++;
+    }
+    return sum;
+}
+
+// Tell the server what the reply has to fit: the screen, the display
+// buffer and whether SAM speaks it (without speech it skips text_sam).
+// With the reply cache the SAM chunks are kept even with SPEAK off, so
+// REPLAY can speak them later.
+static void add_caps(json_writer *json)
+{
+    char num[8];
+
+    json_add_string(json, "platform", PLATFORM_NAME);
+    str_fmt(num, sizeof(num), "%d", SCREEN_WIDTH);
+    json_add_string(json, "cols", num);
+    str_fmt(num, sizeof(num), "%d", SCREEN_HEIGHT);
+    json_add_string(json, "rows", num);
+    str_fmt(num, sizeof(num), "%d", MAX_TEXT_SIZE - 1);
+    json_add_string(json, "max_reply", num);
+#ifdef BUILD_ATARI
+    json_add_string(json, "speech", (speak || cache_available()) ? "1" : "0");
+#else
+    json_add_string(json, "speech", "0");
+#endif
+}
+
+bool send_openai_request(char *question)
 {
     int err;
-    int elapsed = 0;
     bool retried = false;
     char error_msg[64] = "";
+    uint16_t sum;
+    uint8_t result;
+    json_writer json;
 
-retry_submit:
-    escape_json_string(user_input, escaped_input, sizeof(escaped_input));
+    // Answer a question left over from before first, the server only runs
+    // one request per token at a time
+    if (!check_pending())
+        return false;
 
-    // Step 1: POST user input to submit_request.php
-    snprintf(devicespec, sizeof(devicespec), "N1:%s%s", PROXY_API_URL, SUBMIT_URL);
+    arena_enter(PHASE_REQUEST);
+    sum = input_checksum(question);
+    if (!turn_open || sum != turn_sum)
+    {
+        turn_seq++;
+        turn_sum = sum;
+        str_fmt(turn_key, sizeof(turn_key), "%u-%u-%u", turn_run, turn_seq, turn_sum);
+    }
+    turn_open = true;
+
+retry_submit:
+    // Step 1: POST user input to submit_request.php. It may already hold
+    // the answer if it comes within SUBMIT_WAIT seconds.
+    url_build(SUBMIT_URL);
+
+    // The message is escaped straight into the payload, so it goes last
+    json_begin(&json, JSON_PAYLOAD, REQUEST_BUFFER_SIZE);
+    json_add_string(&json, "token_id", app_token);
+    json_add_string(&json, "idem_key", turn_key);
+    json_add_string(&json, "wait", SUBMIT_WAIT);
+    add_caps(&json);
+    json_add_string(&json, "message", question);
+    if (!json_end(&json))
+    {
+        out_str("Note: Message too long, sending the first part.\n");
+    }
 
-    snprintf(json_payload, REQUEST_BUFFER_SIZE,
-        "{"
-        "\"token_id\":\"%s\","
-        "\"message\":\"%s\""
-        "}",
-        app_token, escaped_input);
+    out_str("Thinking...");
 
-    err = network_open(devicespec, OPEN_MODE_HTTP_POST, OPEN_TRANS_NONE);
+    err = network_open(DEVICESPEC, OPEN_MODE_HTTP_POST, OPEN_TRANS_NONE);
     if (err != 0)
     {
-        printf("Error: Unable to open network channel.\n");
+        out_str("\nError: Unable to open network channel.\n");
         return false;
     }
 
-    network_http_start_add_headers(devicespec);
-    network_http_add_header(devicespec, "Content-Type: application/json");
-    network_http_end_add_headers(devicespec);
+    network_http_start_add_headers(DEVICESPEC);
+    network_http_add_header(DEVICESPEC, "Content-Type: application/json");
+    network_http_end_add_headers(DEVICESPEC);
 
-    err = network_http_post(devicespec, json_payload);
+    err = network_http_post(DEVICESPEC, JSON_PAYLOAD);
     if (err != 0)
     {
-        printf("Error: Failed to send data.\n");
-        network_close(devicespec);
+        out_str("\nError: Failed to send data.\n");
+        network_close(DEVICESPEC);
         return false;
     }
 
-    err = network_json_parse(devicespec);
+    err = network_json_parse(DEVICESPEC);
     if (err != 0)
     {
-        printf("Error: Failed to parse JSON response.\n");
-        network_close(devicespec);
+        out_str("\nError: Failed to parse JSON response.\n");
+        network_close(DEVICESPEC);
         return false;
     }
 
     error_msg[0] = '\0';
-    err = network_json_query(devicespec, "/error", error_msg);
+    err = network_json_query(DEVICESPEC, "/error", error_msg);
     if (err > 0 && strcmp(error_msg, "Invalid token") == 0)
     {
-        network_close(devicespec);
-        printf("Token expired. Requesting new token...\n");
+        network_close(DEVICESPEC);
+        out_str("\nToken expired. Requesting new token...\n");
         if (!new_convo())
         {
-            printf("Error: Failed to renew token.\n");
+            out_str("Error: Failed to renew token.\n");
             return false;
         }
         if (!retried)
@@ -194,105 +331,345 @@ retry_submit:
             retried = true;
             goto retry_submit;
         }
-        printf("Error: Token renewed but request failed.\n");
+        out_str("Error: Token renewed but request failed.\n");
+        return false;
+    }
+    if (err > 0)
+    {
+        // A request already running for this token (409) comes with its
+        // message_id, e.g. after this client gave up waiting. Pick it up
+        // again, the new question can be asked once it is answered.
+        message_id[0] = '\0';
+        network_json_query(DEVICESPEC, "/message_id", message_id);
+        network_close(DEVICESPEC);
+        if (strlen(message_id) > 0)
+        {
+            out_str("\nYour last question is still running.\n");
+            pending_save();
+            if (wait_for_reply(CHECK_TIMEOUT) == REPLY_WAITING)
+                out_fmt("\nNo reply after %d seconds. Type RESUME to keep waiting.\n", CHECK_TIMEOUT);
+            return false;
+        }
+
+        // Turned away by the server, e.g. busy
+        out_fmt("\nError: %s\n", error_msg);
         return false;
     }
 
     // Extract message_id and status
-    network_json_query(devicespec, "/message_id", message_id);
-    network_json_query(devicespec, "/status", status);
-    network_close(devicespec);
+    network_json_query(DEVICESPEC, "/message_id", message_id);
+    network_json_query(DEVICESPEC, "/status", status);
 
     if (strlen(message_id) == 0)
     {
-        printf("Error: Invalid response from server.\n");
+        network_close(DEVICESPEC);
+        out_str("\nError: Invalid response from server.\n");
         return false;
     }
 
-    printf("Thinking...");
+    // Quick answers come back with the submit, no polling needed
+    if (strcmp(status, "complete") == 0)
+    {
+        arena_enter(PHASE_POLL);
+        show_reply();
+        network_close(DEVICESPEC);
+        return true;
+    }
+    network_close(DEVICESPEC);
+
+    pending_save();
+    result = wait_for_reply(CHECK_TIMEOUT);
+    if (result == REPLY_WAITING)
+        out_fmt("\nNo reply after %d seconds. Type RESUME to keep waiting.\n", CHECK_TIMEOUT);
+
+    return result == REPLY_DONE;
+}
+
+// Show the completed reply parsed on the open channel. The channel stays
+// open while the reply is shown so the speech chunks can be read from the
+// parsed JSON afterwards.
+static void show_reply(void)
+{
+    pending_clear();
+
+    network_json_query(DEVICESPEC, "/text_display", RESPONSE_BUFFER);
+    strncpy(TEXT_DISPLAY, RESPONSE_BUFFER, MAX_TEXT_SIZE - 1);
+    TEXT_DISPLAY[MAX_TEXT_SIZE - 1] = '\0';
+    turn_open = false;
+    arena_enter(PHASE_RENDER);
 
-    // Step 2: Poll check_request.php until complete or timeout
-    for (elapsed = 0; elapsed < CHECK_TIMEOUT; elapsed += CHECK_INTERVAL)
+    process_response(TEXT_DISPLAY);
+}
+
+// Sleep up to seconds, returning true as soon as a key is waiting
+static bool key_wait(uint8_t seconds)
+{
+    while (seconds--)
     {
-        snprintf(devicespec, sizeof(devicespec),
-                 "N1:%s%s?token_id=%s&message_id=%s",
-                 PROXY_API_URL, CHECK_URL, app_token, message_id);
+        if (kbhit())
+            return true;
+        sleep(1);
+    }
+    return kbhit();
+}
+
+// Drop the current question on the server, which also stops its worker
+static void cancel_request(void)
+{
+    json_writer json;
+
+    out_str("\nCancelling...");
+    url_build(CANCEL_URL);
+
+    json_begin(&json, JSON_PAYLOAD, REQUEST_BUFFER_SIZE);
+    json_add_string(&json, "token_id", app_token);
+    json_add_string(&json, "message_id", message_id);
+    json_end(&json);
+
+    if (network_open(DEVICESPEC, OPEN_MODE_HTTP_POST, OPEN_TRANS_NONE) == 0)
+    {
+        network_http_start_add_headers(DEVICESPEC);
+        network_http_add_header(DEVICESPEC, "Content-Type: application/json");
+        network_http_end_add_headers(DEVICESPEC);
+        network_http_post(DEVICESPEC, JSON_PAYLOAD);
+        network_json_parse(DEVICESPEC);
+        network_close(DEVICESPEC);
+    }
+
+    // Even if the server didn't hear it, this answer is no longer wanted
+    pending_clear();
+    turn_open = false;
+    out_str("done\n");
+}
+
+// ---------------------------------------------------------------------------
+// Poll check_request.php for message_id until the reply is complete or
+// timeout seconds have passed, then show it. Polls at least once, and a
+// key press between polls cancels the question.
+//
+// Each poll asks the server to hold it for up to CHECK_HOLD seconds until
+// the answer is done (long poll), so a turn usually needs one or two
+// requests. A server that answers at once (no "held" in the reply) is
+// polled every CHECK_INTERVAL seconds instead.
+// ---------------------------------------------------------------------------
+static uint8_t wait_for_reply(int timeout)
+{
+    int err;
+    int elapsed;
+    int hold;
+    int step = 0;
+    bool held = false;
+    char error_msg[64];
+    char queue_pos[8];
+    char hold_str[8];
+
+    arena_enter(PHASE_POLL);
+
+    for (elapsed = 0; ; elapsed += step)
+    {
+        if (elapsed > 0)
+        {
+            if (elapsed >= timeout)
+                return REPLY_WAITING;
+
+            // Any key gives up on the answer. The key is left for the
+            // next prompt, so typing ahead starts the next question.
+            // A held poll already did the waiting.
+            if (held ? kbhit() : key_wait(CHECK_INTERVAL))
+            {
+                cancel_request();
+                return REPLY_FAILED;
+            }
+        }
+
+        held = false;
+        poll_failed = true;
+        step = CHECK_INTERVAL;
+        hold = timeout - elapsed;
+        if (hold > CHECK_HOLD)
+            hold = CHECK_HOLD;
+
+        url_build(CHECK_URL);
+        url_add_param("token_id", app_token);
+        url_add_param("message_id", message_id);
+        if (hold > 0)
+        {
+            str_fmt(hold_str, sizeof(hold_str), "%d", hold);
+            url_add_param("wait", hold_str);
+        }
 
-        err = network_open(devicespec, OPEN_MODE_HTTP_GET, OPEN_TRANS_NONE);
+        err = network_open(DEVICESPEC, OPEN_MODE_HTTP_GET, OPEN_TRANS_NONE);
         if (err != 0)
         {
-            printf("Error: Network open failed.\n");
-            sleep(CHECK_INTERVAL);
+            out_str("Error: Network open failed.\n");
             continue;
         }
 
-        err = network_json_parse(devicespec);
+        err = network_json_parse(DEVICESPEC);
         if (err != 0)
         {
-            printf("Error: JSON parse failed.\n");
-            network_close(devicespec);
-            sleep(CHECK_INTERVAL);
+            out_str("Error: JSON parse failed.\n");
+            network_close(DEVICESPEC);
             continue;
         }
 
         error_msg[0] = '\0';
-        err = network_json_query(devicespec, "/error", error_msg);
-        if (err > 0 && strcmp(error_msg, "Token expired") == 0)
+        err = network_json_query(DEVICESPEC, "/error", error_msg);
+        if (err > 0 && strcmp(error_msg, "Invalid token") == 0)
         {
-            printf("\nToken expired. Requesting new token...\n");
-            network_close(devicespec);
-            new_convo();
-            return false;
+            // The question belonged to the old token and can't be fetched
+            // with a new one
+            network_close(DEVICESPEC);
+            pending_clear();
+            turn_open = false;
+            out_str("\nToken expired. Requesting new token...\n");
+            if (!new_convo())
+                out_str("Error: Failed to renew token.\n");
+            return REPLY_FAILED;
+        }
+        if (err > 0 && strncmp(error_msg, "Message not found", 17) == 0)
+        {
+            // The server doesn't know the message (any more), stop asking
+            network_close(DEVICESPEC);
+            out_fmt("\nError: %s\n", error_msg);
+            pending_clear();
+            return REPLY_FAILED;
         }
+        if (err > 0)
+        {
+            // E.g. the server lost its database for a moment. The question
+            // may still be running, so it stays pending.
+            network_close(DEVICESPEC);
+            out_fmt("\nError: %s\n", error_msg);
+            return REPLY_WAITING;
+        }
+        poll_failed = false;
 
-        network_json_query(devicespec, "/status", status);
+        network_json_query(DEVICESPEC, "/status", status);
 
-        if (strcmp(status, "complete") == 0)
+        if (strcmp(status, "cancelled") == 0)
         {
-            // Retrieve the completed JSON response
-            network_json_query(devicespec, "/text_display", response_buffer);
-            strncpy(text_display, response_buffer, sizeof(text_display) - 1);
-#ifdef BUILD_ATARI
-            network_json_query(devicespec, "/text_sam", response_buffer);
-            strncpy(text_sam, response_buffer, sizeof(text_sam) - 1);
-#endif
-            network_close(devicespec);
+            network_close(DEVICESPEC);
+            out_str("\nThe question was cancelled.\n");
+            pending_clear();
+            return REPLY_FAILED;
+        }
 
-#ifdef BUILD_ATARI
-            process_response(text_display, text_sam);
-#else
-            process_response(text_display, NULL);
-#endif
+        if (strcmp(status, "complete") == 0)
+        {
+            show_reply();
+            network_close(DEVICESPEC);
+            return REPLY_DONE;
+        }
 
-            return true;
+        // The server held this poll, so the next one can go right away
+        if (network_json_query(DEVICESPEC, "/held", hold_str) > 0 && atoi(hold_str) > 0)
+        {
+            held = true;
+            step = atoi(hold_str);
         }
 
-        network_close(devicespec);
-        printf(".");
+        // While waiting in the server queue show the position instead of a dot
+        queue_pos[0] = '\0';
+        if (network_json_query(DEVICESPEC, "/queue_position", queue_pos) > 0)
+            out_fmt("[%s]", queue_pos);
+        else
+            out_str(".");
+        network_close(DEVICESPEC);
         fflush(stdout);
-        sleep(CHECK_INTERVAL);
     }
+}
 
-    // Timeout after 90 seconds
-    printf("\nError: Request timed out after %d seconds.\n", CHECK_TIMEOUT);
+// Look for the answer to a question left over from a timeout or an earlier
+// run. Returns false while the server is still working on it.
+static bool check_pending(void)
+{
+    if (!pending)
+        return true;
+
+    out_str("Checking your last question...");
+    if (wait_for_reply(0) != REPLY_WAITING)
+        return true;
+
+    // No word from the server isn't an answer still in the works. The new
+    // question goes ahead, and a server still running the old one answers
+    // it with a 409 that picks it up again.
+    if (poll_failed)
+    {
+        out_str("\n");
+        return true;
+    }
+
+    out_str("\nStill working on it. Type RESUME to wait for it.\n");
     return false;
 }
 
+// Keep polling for the pending answer well past CHECK_TIMEOUT
+static void resume_request(void)
+{
+    if (!pending)
+    {
+        out_str("No unanswered question to resume\n");
+        return;
+    }
+
+    out_str("Thinking...");
+    if (wait_for_reply(RESUME_TIMEOUT) == REPLY_WAITING)
+        out_fmt("\nNo reply after %d more seconds.\n", RESUME_TIMEOUT);
+}
+
 // ---------------------------------------------------------------------------
 // Process JSON and forward to display/speech routines
 // ---------------------------------------------------------------------------
-void process_response(const char *text_display, const char *text_sam)
+void process_response(char *text)
 {
-    if (strlen(text_display) > 0)
-        display_text(text_display);
+    process_text(text); // Convert UTF-8 and prepare text
+    cache_begin(text);
+#ifdef REPLY_CACHE
+    replay_back = 0;
+#endif
+
+#ifdef BUILD_ATARI
+    // Speech is fed from display_text() page pauses, then finished here
+    speech_begin_reply();
+#endif
+
+    if (strlen(text) > 0)
+        display_text(text);
     else
-        printf("Error: No text to display\n");
+        out_str("Error: No text to display\n");
 
 #ifdef BUILD_ATARI
-    if (speak && strlen(text_sam) > 0)
-        speak_text(text_sam);
+    speech_end_reply();
 #endif
+
+    cache_end();
+}
+
+#ifdef REPLY_CACHE
+// Show a cached reply again, BACK steps to the one before the last shown
+// and REPLAY also speaks it. No network traffic.
+static void replay_reply(bool step_back)
+{
+    uint8_t back = replay_back + (step_back ? 1 : 0);
+
+    if (back >= cache_count())
+    {
+        out_str(cache_count() ? "No earlier replies cached\n" : "No replies cached\n");
+        return;
+    }
+
+    replay_back = back;
+    arena_enter(PHASE_RENDER);
+    cache_fetch(back, TEXT_DISPLAY, RESPONSE_BUFFER, RESPONSE_BUFFER_SIZE);
+
+    if (!step_back && speak)
+        speech_begin_replay(RESPONSE_BUFFER);
+    display_text(TEXT_DISPLAY);
+    if (!step_back && speak)
+        speech_end_reply();
 }
+#endif
 
 // Convert UTF-8 characters to ASCII equivalents and replace them in text
 void process_text(char *text)
@@ -415,21 +792,16 @@ void process_text(char *text)
     *dst = '\0'; // Null terminate
 }
 
-// Display text on Atari screen with word wrap
+// Display text with word wrap through the reply renderer (see screen.h).
+// The text has already been through process_text().
 void display_text(char *text)
 {
-    int line_length = 0, word_length = 0, i = 0, w = 0, lines = 0;
+    int line_length = 0, word_length = 0, lines = 0;
     char *word_start;
-    char *pos;
 
-#ifdef BUILD_MSDOS
-    putchar(CR);
-#endif
-
-    putchar(NEWLINE);
-
-    process_text(text); // Convert UTF-8 and prepare text
-    pos = text;
+    scr_begin();
+    if (!scr_page(strlen(text)))
+        scr_newline();
 
     while (*text)
     {
@@ -442,38 +814,25 @@ void display_text(char *text)
 
         if (line_length + word_length >= SCREEN_WIDTH - 1)
         {
-#ifdef BUILD_MSDOS
-            putchar(CR);
-#endif
-
-            putchar(NEWLINE); // Move to next line if word doesn't fit
+            scr_newline(); // Move to next line if word doesn't fit
             line_length = 0;
             lines++;
         }
 
-        // Print each character from the processed text
-        for (i = 0; i < word_length; i++)
-        {
-            putchar(word_start[i]);
-        }
+        scr_write(word_start, word_length);
         line_length += word_length;
 
         while (*text && isspace(*text))
         {
             if (*text == '\n')
             {
-#ifdef BUILD_MSDOS
-                putchar(CR);
-#endif
-            }
-            putchar(*text == '\n' ? NEWLINE : *text); // Convert '\n' to ATASCII newline
-            if (*text == '\n')
-            {
+                scr_newline();
                 line_length = 0;
                 lines++;
             }
             else
             {
+                scr_write(text, 1);
                 line_length++;
             }
             text++;
@@ -482,47 +841,22 @@ void display_text(char *text)
         // Pause for reading if screen full
         if (lines >= SCREEN_HEIGHT)
         {
-            printf("\nPress RETURN to continue...\n");
+            scr_end();
+            out_str("\nPress RETURN to continue...\n");
+#ifdef BUILD_ATARI
+            // Let SAM read the reply aloud while this page is on screen
+            while (!kbhit() && speech_pump())
+                ;
+#endif
             getchar();  // Wait for key press before continuing
             lines = 0;
+            scr_begin();
+            scr_page(strlen(text));
         }
     }
-#ifdef BUILD_MSDOS
-    putchar(CR);
-#endif
-
-    putchar(NEWLINE);
-}
-
-// Escape special characters in user input for JSON compatibility
-void escape_json_string(const char *input, char *output, int output_size)
-{
-    int i = 0, j = 0;
-    while (input[i] != '\0') {
-        char c = input[i];
-
-        // Check if we need to escape this char
-        if (c == '"' || c == '\\' || c == '/') {
-            // We need two bytes: '\' plus the character itself
-            if (j + 2 >= output_size) break;  // not enough room
-            output[j++] = '\\';
-            output[j++] = c;
-        }
-        else {
-            // Just a normal character
-            if (j + 1 >= output_size) break;
-            output[j++] = c;
-        }
-
-        i++;
-    }
 
-    // NULL‐terminate
-    if (j < output_size) {
-        output[j] = '\0';
-    } else {
-        output[output_size - 1] = '\0';
-    }
+    scr_newline();
+    scr_end();
 }
 
 void get_user_input(char *buffer, int max_length)
@@ -541,7 +875,7 @@ void get_user_input(char *buffer, int max_length)
         if (ch == '\r' || ch == '\n') // Enter key
         {
             buffer[index] = '\0'; // Null-terminate string
-            printf("\n"); // Move to new line
+            out_str("\n"); // Move to new line
             break;
         }
         else if ((ch == 0x08 || ch == 0x7F || ch == 0x7E) && index > 0) // Handle Backspace
@@ -579,7 +913,7 @@ void get_user_input(char *buffer, int max_length)
         else if (index < max_length - 1 && ch >= 32 && ch <= 126 && ch != '~') // Normal character
         {
             buffer[index++] = ch;
-            putchar(ch); // Echo character
+            out_char(ch); // Echo character
         }
     }
 #endif
@@ -591,8 +925,9 @@ static void print_centered(const char *s)
     int pad = (SCREEN_WIDTH - len) / 2;
     int i;
     if (pad < 0) pad = 0;
-    for (i = 0; i < pad; i++) putchar(' ');
-    printf("%s\n", s);
+    for (i = 0; i < pad; i++) out_char(' ');
+    out_str(s);
+    out_char('\n');
 }
 
 static void print_wrapped(const char *text)
@@ -609,28 +944,28 @@ static void print_wrapped(const char *text)
         wl = (int)(p - wstart);
         if (line_len > 0 && line_len + 1 + wl > w)
         {
-            putchar('\n');
+            out_char('\n');
             line_len = 0;
         }
         if (line_len > 0)
         {
-            putchar(' ');
+            out_char(' ');
             line_len++;
         }
         while (wstart < p)
         {
-            putchar(*wstart++);
+            out_char(*wstart++);
             line_len++;
         }
         while (*p == ' ' || *p == '\t') p++;
         if (*p == '\n')
         {
-            putchar('\n');
+            out_char('\n');
             line_len = 0;
             p++;
         }
     }
-    if (line_len > 0) putchar('\n');
+    if (line_len > 0) out_char('\n');
 }
 
 void print_help()
@@ -644,10 +979,10 @@ void print_help()
     if (dashes < 0) dashes = 0;
     left = dashes / 2;
     right = dashes - left;
-    for (i = 0; i < left; i++) putchar('-');
-    printf(" %s ", title);
-    for (i = 0; i < right; i++) putchar('-');
-    putchar('\n');
+    for (i = 0; i < left; i++) out_char('-');
+    out_fmt(" %s ", title);
+    for (i = 0; i < right; i++) out_char('-');
+    out_char('\n');
 
     print_wrapped(
         "AI SAM is an interface with OpenAI ChatGPT. "
@@ -660,15 +995,20 @@ void print_help()
         "which tells the server to delete all messages "
         "for your token id and provides a new token."
     );
-    printf("\n");
-    printf(" HELP       Prints this message\n");
-    printf(" EXIT       Exit the program\n");
+    out_str("\n");
+    out_str(" HELP       Prints this message\n");
+    out_str(" EXIT       Exit the program\n");
 #ifdef BUILD_ATARI
-    printf(" SPEAKOFF   Turn OFF SAM audio\n");
-    printf(" SPEAKON    Turn ON SAM audio\n");
+    out_str(" SPEAKOFF   Turn OFF SAM audio\n");
+    out_str(" SPEAKON    Turn ON SAM audio\n");
+#endif
+#ifdef REPLY_CACHE
+    out_str(" BACK       Show the previous reply\n");
+    out_str(" REPLAY     Repeat reply with SAM\n");
 #endif
-    printf(" CLS        Clear the screen\n");
-    printf(" NEW        Start new conversation\n");
+    out_str(" CLS        Clear the screen\n");
+    out_str(" NEW        Start new conversation\n");
+    out_str(" RESUME     Wait for a late answer\n");
 }
 
 int main()
@@ -688,59 +1028,73 @@ int main()
 
     if (!init_fujinet())
     {
-        printf("Press any key to quit\n");
+        out_str("Press any key to quit\n");
         getchar();
         return 1;  // Exit if FujiNet is not available
     }
 
+#ifdef REPLY_CACHE
+    cache_init();
+#endif
+
+    check_pending();
+
     print_centered("Type HELP for a list of commands");
     print_centered("Ask me anything...");
 
     while (1)
     {
-        user_input[0] = '\0';
-        text_display[0] = '\0';
-#ifdef BUILD_ATARI        
-        text_sam[0] = '\0';
-#endif
-        json_payload[0] = '\0';
-        response_buffer[0] = '\0';
+        arena_enter(PHASE_INPUT);
 
-        printf("\n> ");
-        get_user_input(user_input, sizeof(user_input)-1);
+        out_str("\n> ");
+        get_user_input(USER_INPUT, USER_INPUT_SIZE - 1);
     
-        if (!stricmp(user_input, "HELP"))
+        if (!stricmp(USER_INPUT, "HELP"))
         {
             print_help();
         }
-        else if (!stricmp(user_input, "EXIT"))
+        else if (!stricmp(USER_INPUT, "EXIT"))
         {
-            printf("Goodbye!\n");
+            out_str("Goodbye!\n");
             break;
         }
 #ifdef BUILD_ATARI
-        else if (strcmp(user_input, "speakon") == 0 || strcmp(user_input, "SPEAKON") == 0)
+        else if (strcmp(USER_INPUT, "speakon") == 0 || strcmp(USER_INPUT, "SPEAKON") == 0)
         {
             speak = true;
-            printf("Turned ON SAM audio output\n");
+            out_str("Turned ON SAM audio output\n");
         }
-        else if (strcmp(user_input, "speakoff") == 0 || strcmp(user_input, "SPEAKOFF") == 0)
+        else if (strcmp(USER_INPUT, "speakoff") == 0 || strcmp(USER_INPUT, "SPEAKOFF") == 0)
         {
             speak = false;
-            printf("Turned OFF SAM audio output\n");
+            out_str("Turned OFF SAM audio output\n");
         }
 #endif
-        else if (!stricmp(user_input, "CLS"))
+#ifdef REPLY_CACHE
+        else if (!stricmp(USER_INPUT, "BACK"))
+        {
+            replay_reply(true);
+        }
+        else if (!stricmp(USER_INPUT, "REPLAY"))
+        {
+            replay_reply(false);
+        }
+#endif
+        else if (!stricmp(USER_INPUT, "CLS"))
         {
             clrscr();
         }
-        else if (!stricmp(user_input, "NEW"))
+        else if (!stricmp(USER_INPUT, "RESUME"))
+        {
+            resume_request();
+        }
+        else if (!stricmp(USER_INPUT, "NEW"))
         {
             new_convo();
         }
         else
         {
-            res = send_openai_request(user_input);
+            res = send_openai_request(USER_INPUT);
         }
     }
 
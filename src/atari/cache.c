@@ -0,0 +1,221 @@
+#include <atari.h>
+#include <ai-sam.h>
+#include <cache.h>
+
+// 130XE extended memory: four 16 KB banks that PORTB switches into
+// $4000-$7FFF. The program itself may sit in that window, so the copying
+// is done by a small routine in page 6 through a 128 byte bounce buffer
+// there, and C code never runs with a bank switched in.
+#define XMEM_CODE    ((uint8_t *)0x0600)
+#define XMEM_RESULT  (*(uint8_t *)0x067C)
+#define XMEM_BANK    (*(uint8_t *)0x067D)  // PORTB with a bank switched in
+#define XMEM_MAIN    (*(uint8_t *)0x067E)  // PORTB for main memory
+#define XMEM_BOUNCE  ((uint8_t *)0x0680)
+#define XMEM_PIECE   128
+
+#define XMEM_TO_BANK   0x0600
+#define XMEM_FROM_BANK 0x0618
+#define XMEM_CHECK     0x0630
+
+typedef void (*xmem_fn)(void);
+
+// Page 6 routines. The length and window address operands are patched
+// before each call (see xmem_copy()).
+static const uint8_t xmem_code[] =
+{
+    // $0600 to_bank: copy bounce buffer to the bank
+    0xAD, 0x7D, 0x06,   // LDA XMEM_BANK
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0xA2, 0x7F,         // LDX #len-1
+    0xBD, 0x80, 0x06,   // LDA XMEM_BOUNCE,X
+    0x9D, 0x00, 0x40,   // STA window,X
+    0xCA,               // DEX
+    0x10, 0xF7,         // BPL $0608
+    0xAD, 0x7E, 0x06,   // LDA XMEM_MAIN
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0x60,               // RTS
+
+    // $0618 from_bank: copy from the bank to the bounce buffer
+    0xAD, 0x7D, 0x06,   // LDA XMEM_BANK
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0xA2, 0x7F,         // LDX #len-1
+    0xBD, 0x00, 0x40,   // LDA window,X
+    0x9D, 0x80, 0x06,   // STA XMEM_BOUNCE,X
+    0xCA,               // DEX
+    0x10, 0xF7,         // BPL $0620
+    0xAD, 0x7E, 0x06,   // LDA XMEM_MAIN
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0x60,               // RTS
+
+    // $0630 check: write $55 and then $AA to $4000 in the bank and see if
+    // main memory shows both, which means PORTB doesn't switch banks (a
+    // 64 KB machine). Main memory can't hold both values by chance.
+    0xAD, 0x7D, 0x06,   // LDA XMEM_BANK
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0xAD, 0x00, 0x40,   // LDA $4000
+    0x48,               // PHA
+    0xA2, 0x00,         // LDX #0
+    0xAC, 0x7E, 0x06,   // LDY XMEM_MAIN
+    0xA9, 0x55,         // LDA #$55
+    0x8D, 0x00, 0x40,   // STA $4000
+    0x8C, 0x01, 0xD3,   // STY PORTB
+    0xCD, 0x00, 0x40,   // CMP $4000
+    0xD0, 0x14,         // BNE $0660
+    0xAD, 0x7D, 0x06,   // LDA XMEM_BANK
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0xA9, 0xAA,         // LDA #$AA
+    0x8D, 0x00, 0x40,   // STA $4000
+    0x8C, 0x01, 0xD3,   // STY PORTB
+    0xCD, 0x00, 0x40,   // CMP $4000
+    0xD0, 0x01,         // BNE $0660
+    0xE8,               // INX
+    0xAD, 0x7D, 0x06,   // LDA XMEM_BANK
+    0x8D, 0x01, 0xD3,   // STA PORTB
+    0x68,               // PLA
+    0x8D, 0x00, 0x40,   // STA $4000
+    0x8C, 0x01, 0xD3,   // STY PORTB
+    0x8E, 0x7C, 0x06,   // STX XMEM_RESULT
+    0x60                // RTS
+};
+
+// Patched operands in xmem_code
+#define TO_BANK_LEN     0x07
+#define TO_BANK_ADDR    0x0C
+#define FROM_BANK_LEN   0x1F
+#define FROM_BANK_ADDR  0x21
+
+// Each reply gets a 4 KB slot, so a slot never crosses a bank:
+// the displayed text first, then the SAM chunks as NUL terminated strings
+// ending with an empty one.
+#define SLOT_SIZE   4096
+#define SLOT_SAM    1024
+#define SAM_SPACE   (SLOT_SIZE - SLOT_SAM)
+
+static bool present = false;
+static uint8_t newest = CACHE_REPLIES - 1;
+static uint8_t count = 0;
+static bool entry_open = false;
+static uint16_t sam_len;
+
+// Copy between main memory and extended address xaddr (bank in the top
+// two bits), in pieces that fit the bounce buffer
+static void xmem_copy(uint16_t xaddr, char *buf, uint16_t len, bool to_bank)
+{
+    uint16_t window;
+    uint8_t n;
+
+    while (len)
+    {
+        n = len > XMEM_PIECE ? XMEM_PIECE : (uint8_t)len;
+        XMEM_BANK = (XMEM_MAIN & 0xE3) | ((xaddr >> 12) & 0x0C);
+        window = 0x4000 | (xaddr & 0x3FFF);
+
+        if (to_bank)
+        {
+            memcpy(XMEM_BOUNCE, buf, n);
+            XMEM_CODE[TO_BANK_LEN] = n - 1;
+            XMEM_CODE[TO_BANK_ADDR] = (uint8_t)window;
+            XMEM_CODE[TO_BANK_ADDR + 1] = (uint8_t)(window >> 8);
+            ((xmem_fn)XMEM_TO_BANK)();
+        }
+        else
+        {
+            XMEM_CODE[FROM_BANK_LEN] = n - 1;
+            XMEM_CODE[FROM_BANK_ADDR] = (uint8_t)window;
+            XMEM_CODE[FROM_BANK_ADDR + 1] = (uint8_t)(window >> 8);
+            ((xmem_fn)XMEM_FROM_BANK)();
+            memcpy(buf, XMEM_BOUNCE, n);
+        }
+
+        xaddr += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+static uint16_t slot_addr(uint8_t slot)
+{
+    return (uint16_t)slot * SLOT_SIZE;
+}
+
+bool cache_init(void)
+{
+    memcpy(XMEM_CODE, xmem_code, sizeof(xmem_code));
+    XMEM_MAIN = PIA.portb;
+    XMEM_BANK = XMEM_MAIN & 0xE3;
+    ((xmem_fn)XMEM_CHECK)();
+
+    present = (XMEM_RESULT == 0);
+    return present;
+}
+
+bool cache_available(void)
+{
+    return present;
+}
+
+void cache_begin(const char *text)
+{
+    uint16_t len = strlen(text) + 1;
+
+    if (!present)
+        return;
+
+    if (len > SLOT_SAM)
+        len = SLOT_SAM;
+
+    newest = (newest + 1) % CACHE_REPLIES;
+    if (count < CACHE_REPLIES)
+        count++;
+
+    xmem_copy(slot_addr(newest), (char *)text, len, true);
+    sam_len = 0;
+    entry_open = true;
+}
+
+void cache_add_sam(const char *chunk)
+{
+    uint16_t len = strlen(chunk) + 1;
+
+    // Keep room for the closing empty string
+    if (!entry_open || sam_len + len >= SAM_SPACE)
+        return;
+
+    xmem_copy(slot_addr(newest) + SLOT_SAM + sam_len, (char *)chunk, len, true);
+    sam_len += len;
+}
+
+void cache_end(void)
+{
+    if (!entry_open)
+        return;
+
+    xmem_copy(slot_addr(newest) + SLOT_SAM + sam_len, "", 1, true);
+    entry_open = false;
+}
+
+uint8_t cache_count(void)
+{
+    return count;
+}
+
+// Fetch a reply, 0 being the newest. sam gets the SAM chunks as
+// NUL terminated strings ending with an empty one.
+bool cache_fetch(uint8_t back, char *text, char *sam, uint16_t sam_size)
+{
+    uint8_t slot;
+
+    if (back >= count)
+        return false;
+
+    slot = (newest + CACHE_REPLIES - back) % CACHE_REPLIES;
+    xmem_copy(slot_addr(slot), text, MAX_TEXT_SIZE, false);
+    text[MAX_TEXT_SIZE - 1] = '\0';
+
+    if (sam_size > SAM_SPACE)
+        sam_size = SAM_SPACE;
+    xmem_copy(slot_addr(slot) + SLOT_SAM, sam, sam_size, false);
+    sam[sam_size - 2] = '\0';
+    sam[sam_size - 1] = '\0';
+    return true;
+}
@@ -0,0 +1,104 @@
+#include <atari.h>
+#include <ai-sam.h>
+#include <speech.h>
+#include <screen.h>
+
+// Direct GRAPHICS 0 renderer. Instead of a CIO call per character through
+// the E: editor, words are stored in screen memory (SAVMSC) as internal
+// codes. The editor's cursor variables are only read in scr_begin() and
+// written back in scr_end().
+
+#define ROWS 24
+#define COLS 40
+
+static uint8_t *row_ptr;  // start of the current row in screen memory
+static uint8_t row, col;
+
+// ATASCII to the internal (screen) code, inverse video bit kept
+static uint8_t internal_code(uint8_t c)
+{
+    uint8_t inv = c & 0x80;
+
+    c &= 0x7F;
+    if (c < 0x20)
+        c += 0x40;
+    else if (c < 0x60)
+        c -= 0x20;
+    return c | inv;
+}
+
+static void scroll_up(void)
+{
+    uint8_t *screen = OS.savmsc;
+
+    memmove(screen, screen + COLS, (ROWS - 1) * COLS);
+    memset(screen + (ROWS - 1) * COLS, 0, COLS);
+}
+
+void scr_begin(void)
+{
+    // The editor shows its cursor by inverting the character under it
+    if (OS.oldadr)
+        *OS.oldadr = OS.oldchr;
+
+    row = OS.rowcrs;
+    col = (uint8_t)OS.colcrs;
+    row_ptr = OS.savmsc + row * COLS;
+}
+
+void scr_newline(void)
+{
+    col = OS.lmargn;
+    if (row < ROWS - 1)
+    {
+        row++;
+        row_ptr += COLS;
+    }
+    else
+    {
+        scroll_up();
+    }
+}
+
+void scr_write(const char *s, uint16_t len)
+{
+    uint8_t c;
+
+    while (len--)
+    {
+        c = (uint8_t)*s++;
+        if (c == NEWLINE || c == '\n')
+        {
+            scr_newline();
+            continue;
+        }
+
+        // Wrap at the right margin like the editor, but don't start the
+        // next row with the space that didn't fit
+        if (col > OS.rmargn)
+        {
+            scr_newline();
+            if (c == ' ')
+                continue;
+        }
+        row_ptr[col++] = internal_code(c);
+    }
+}
+
+void scr_end(void)
+{
+    if (col > OS.rmargn)
+        scr_newline();
+
+    // Hand the position back to the editor and draw its cursor there
+    OS.rowcrs = OS.oldrow = row;
+    OS.colcrs = OS.oldcol = col;
+    OS.oldadr = row_ptr + col;
+    OS.oldchr = *OS.oldadr;
+    if (!OS.crsinh)
+        *OS.oldadr ^= 0x80;
+
+    // Rows were moved behind the editor's back, so make every row the
+    // start of its own logical line
+    OS.logmap[0] = OS.logmap[1] = OS.logmap[2] = 0xFF;
+}
@@ -1,77 +1,113 @@
 #include <ai-sam.h>
 #include <speech.h>
+#include <cache.h>
 
-// Speak text using FujiNet SAM
-void speak_text(const char *sam_text)
-{
-    int len;
-    int start;
-    int max_end;
-    int end;
-    int chunk_len;
-    int i;
-    char chunk[SAM_CHUNK_SIZE + 1];
-    char c;
-    FILE *printer;
+static FILE *printer = NULL;
 
-    len   = strlen(sam_text);
-    start = 0;
+// Open the FujiNet SAM printer device, kept open until speech_close()
+bool speech_open(void)
+{
+    if (printer)
+        return true;
 
     printer = fopen("P4:", "w");
     if (!printer) {
-        printf("Unable to access FujiNet SAM printer device (P4)\nTurning off speech.\n");
+        out_str("Unable to access FujiNet SAM printer device (P4)\nTurning off speech.\n");
         speak = false;
-        return;
+        return false;
     }
+    return true;
+}
 
-    while (start < len) {
-        /* determine the farthest we can go in this chunk */
-        max_end = start + SAM_CHUNK_SIZE;
-        if (max_end > len) {
-            max_end = len;
-        }
-        end = max_end;
+void speech_close(void)
+{
+    if (printer) {
+        fclose(printer);
+        printer = NULL;
+    }
+}
 
-        /* Try to break on a sentence boundary */
-        for (i = max_end - 1; i > start; --i) {
-            c = sam_text[i];
-            if (c == '.' || c == '?' || c == '!') {
-                end = i + 1;
-                break;
-            }
-        }
+// Speak text that fits in one SAM chunk (SAM_CHUNK_SIZE)
+void speak_text(const char *sam_text)
+{
+    if (!speech_open())
+        return;
 
-        /* If no sentence end found, break on last whitespace */
-        if (end == max_end) {
-            for (i = max_end; i > start; --i) {
-                if (isspace((unsigned char)sam_text[i])) {
-                    end = i;
-                    break;
-                }
-            }
-            /* If still no break point, force at max_end */
-            if (end == start) {
-                end = max_end;
-            }
-        }
+    fputs(sam_text, printer);
+    fputc('\n', printer);
+    speech_close();
+}
 
-        /* Copy and NULL-terminate */
-        chunk_len = end - start;
-        if (chunk_len > SAM_CHUNK_SIZE) {
-            chunk_len = SAM_CHUNK_SIZE;
-        }
-        memcpy(chunk, sam_text + start, chunk_len);
-        chunk[chunk_len] = '\0';
+// Replies are spoken from a small queue: the server already split the text
+// into SAM sized chunks, and the JSON stays parsed on the open network
+// channel, so each chunk is fetched into a small buffer right before it is
+// spoken. speech_pump() speaks one chunk, which lets display_text() keep SAM
+// talking while a page is on screen instead of after the whole reply. The
+// P4: write blocks until SAM is done with the chunk, so speech can't
+// overlap drawing; that would need a write that doesn't wait.
+// Chunks also go to the reply cache, so they are fetched even with speech
+// off when the cache is there, and REPLAY speaks them from the cache.
+static uint8_t next_chunk = 0;
+static bool chunks_left = false;
+static const char *replay_pos = NULL;
+
+void speech_begin_reply(void)
+{
+    next_chunk = 0;
+    replay_pos = NULL;
+    if (speak)
+        speech_open();
+    chunks_left = printer || cache_available();
+}
 
-        /* Send chunk to SAM */
-        fprintf(printer, "%s\n", chunk);
+// Speak SAM chunks kept by the reply cache (see cache_fetch())
+void speech_begin_replay(const char *sam)
+{
+    replay_pos = sam;
+    chunks_left = speech_open();
+}
+
+// Speak the next queued chunk. Returns false once the reply is done.
+bool speech_pump(void)
+{
+    char chunk[SAM_CHUNK_SIZE + 1];
+    char query[20];
+    const char *text = chunk;
 
-        /* move past any whitespace for next chunk */
-        start = end;
-        while (start < len && isspace((unsigned char)sam_text[start])) {
-            start++;
+    if (!chunks_left)
+        return false;
+
+    if (replay_pos)
+    {
+        text = replay_pos;
+        if (!*text) {
+            chunks_left = false;
+            return false;
+        }
+        replay_pos += strlen(text) + 1;
+    }
+    else
+    {
+        str_fmt(query, sizeof(query), "/sam_chunks/%u", next_chunk);
+        if (network_json_query(DEVICESPEC, query, chunk) <= 0) {
+            chunks_left = false;
+            return false;
         }
+        cache_add_sam(chunk);
+        next_chunk++;
     }
 
-    fclose(printer);
-}
\ No newline at end of file
+    if (printer) {
+        fputs(text, printer);
+        fputc('\n', printer);
+    }
+    return true;
+}
+
+// Speak whatever is left of the reply and release the printer device
+void speech_end_reply(void)
+{
+    while (speech_pump())
+        ;
+    speech_close();
+}
@@ -0,0 +1,124 @@
+#include <c64.h>
+#include <ai-sam.h>
+#include <screen.h>
+
+// Direct text screen renderer. Instead of a KERNAL CHROUT call per
+// character, words are stored in screen memory as screen codes with the
+// current text colour in colour RAM. The KERNAL cursor is only read in
+// scr_begin() and set again (via PLOT) in scr_end().
+
+#define ROWS 25
+#define COLS 40
+
+// KERNAL screen editor variables
+#define K_PNTR   (*(uint8_t *)0xD3)    // cursor column in the logical line
+#define K_TBLX   (*(uint8_t *)0xD6)    // cursor row
+#define K_LDTB1  ((uint8_t *)0xD9)     // screen line link table
+#define K_COLOR  (*(uint8_t *)0x0286)  // current text colour
+#define K_HIBASE (*(uint8_t *)0x0288)  // screen memory page
+
+#define SCREEN_MEM ((uint8_t *)(K_HIBASE << 8))
+
+static uint8_t *row_ptr;    // start of the current row in screen memory
+static uint8_t *color_ptr;  // same row in colour RAM
+static uint8_t row, col;
+
+// PETSCII to screen code, control codes become blanks
+static uint8_t screen_code(uint8_t c)
+{
+    if (c < 0x20 || (c >= 0x80 && c < 0xA0))
+        return 0x20;
+    if (c < 0x40)
+        return c;
+    if (c < 0x60)
+        return c - 0x40;
+    if (c < 0x80)
+        return c - 0x20;
+    if (c < 0xC0)
+        return c - 0x40;
+    if (c < 0xFF)
+        return c - 0x80;
+    return 0x5E;
+}
+
+static void scroll_up(void)
+{
+    uint8_t *screen = SCREEN_MEM;
+
+    memmove(screen, screen + COLS, (ROWS - 1) * COLS);
+    memset(screen + (ROWS - 1) * COLS, 0x20, COLS);
+    memmove(COLOR_RAM, COLOR_RAM + COLS, (ROWS - 1) * COLS);
+    memset(COLOR_RAM + (ROWS - 1) * COLS, K_COLOR, COLS);
+}
+
+void scr_begin(void)
+{
+    row = K_TBLX;
+    col = K_PNTR;
+    if (col >= COLS)
+    {
+        // Second half of a linked 80 column logical line
+        col -= COLS;
+        row++;
+    }
+    row_ptr = SCREEN_MEM + row * COLS;
+    color_ptr = COLOR_RAM + row * COLS;
+}
+
+void scr_newline(void)
+{
+    col = 0;
+    if (row < ROWS - 1)
+    {
+        row++;
+        row_ptr += COLS;
+        color_ptr += COLS;
+    }
+    else
+    {
+        scroll_up();
+    }
+}
+
+void scr_write(const char *s, uint16_t len)
+{
+    uint8_t c;
+    uint8_t color = K_COLOR;
+
+    while (len--)
+    {
+        c = (uint8_t)*s++;
+        if (c == '\n')
+        {
+            scr_newline();
+            continue;
+        }
+
+        // Wrap at the last column, dropping a space that didn't fit
+        if (col >= COLS)
+        {
+            scr_newline();
+            if (c == ' ')
+                continue;
+        }
+        row_ptr[col] = screen_code(c);
+        color_ptr[col++] = color;
+    }
+}
+
+void scr_end(void)
+{
+    uint8_t i;
+    uint16_t line = K_HIBASE << 8;
+
+    if (col >= COLS)
+        scr_newline();
+
+    // Rows were moved behind the editor's back, so unlink every row
+    for (i = 0; i < ROWS; i++, line += COLS)
+    {
+        K_LDTB1[i] = (line >> 8) | 0x80;
+    }
+
+    gotoxy(col, row);
+}
@@ -8,9 +8,8 @@
 
 #include <hirestxt.h>
 
-#define SCREEN_BUFFER (byte*) 0xA00
-
 byte colorset = 0;
+byte key_ahead = 0;     // key seen by kbhit(), returned by the next cgetc()
 bool hirestxt_mode = false;
 bool cursor_on = false;
 
@@ -133,6 +132,15 @@ void clear_screen(byte color)
     }
 }
 
+// Check for a key without waiting. inkey() consumes the key, so it is kept
+// for cgetc().
+bool kbhit(void)
+{
+    if (!key_ahead)
+        key_ahead = inkey();
+    return key_ahead != 0;
+}
+
 char cgetc()
 {
     byte shift = false;
@@ -140,7 +148,12 @@ char cgetc()
 
     while (true)
     {
-        if (hirestxt_mode)
+        if (key_ahead)
+        {
+            k = key_ahead;
+            key_ahead = 0;
+        }
+        else if (hirestxt_mode)
         {
             if (cursor_on)
             {
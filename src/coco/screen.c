@@ -0,0 +1,113 @@
+#include <ai-sam.h>
+#include <screen.h>
+
+#ifdef clrscr
+#undef clrscr
+#endif
+
+#include <hirestxt.h>
+
+// Direct renderer for the 42x24 hires text screen. Glyphs are drawn with
+// writeCharAt_42cols() at a position kept here, skipping the printf()
+// redirection and hirestxt's per character cursor handling. Scrolling
+// moves the text rows of the PMODE 4 buffer with 16 bit loads and stores,
+// and a page that fills the screen is drawn on a cleared screen instead.
+
+#define ROWS 24
+#define COLS 42
+#define ROW_BYTES (8 * 32)  // a text row is 8 pixel rows of 32 bytes
+
+static byte row, col;
+
+static void scroll_up(void)
+{
+    byte *screen = SCREEN_BUFFER;
+    byte blank;
+
+    // The last 4 pixels of a row are never drawn, so they show the
+    // background
+    blank = (screen[31] & 1) ? 0xFF : 0x00;
+
+    // Move rows 1-23 up one text row (256 bytes), 8 bytes per loop:
+    // 23 * 256 / 8 = 736 loops
+    asm
+    {
+        ldx     screen
+        pshs    u,y
+        leau    256,x
+        ldy     #736
+@copy:
+        ldd     ,u++
+        std     ,x++
+        ldd     ,u++
+        std     ,x++
+        ldd     ,u++
+        std     ,x++
+        ldd     ,u++
+        std     ,x++
+        leay    -1,y
+        bne     @copy
+        puls    u,y
+    }
+
+    memset(screen + (ROWS - 1) * ROW_BYTES, blank, ROW_BYTES);
+}
+
+void scr_begin(void)
+{
+    row = getCursorRow();
+    col = getCursorColumn();
+}
+
+void scr_newline(void)
+{
+    col = 0;
+    if (row < ROWS - 1)
+        row++;
+    else
+        scroll_up();
+}
+
+void scr_write(const char *s, uint16_t len)
+{
+    byte c;
+
+    while (len--)
+    {
+        c = (byte)*s++;
+        if (c == '\n')
+        {
+            scr_newline();
+            continue;
+        }
+
+        // Wrap at the last column, dropping a space that didn't fit
+        if (col >= COLS)
+        {
+            scr_newline();
+            if (c == ' ')
+                continue;
+        }
+        writeCharAt_42cols(col++, row, c < ' ' ? ' ' : c);
+    }
+}
+
+bool scr_page(uint16_t remaining)
+{
+    // Only worth it when the rest of the reply fills a whole page
+    if (remaining < (SCREEN_WIDTH - 1) * SCREEN_HEIGHT)
+        return false;
+
+    clrscr();
+    row = 0;
+    col = 0;
+    return true;
+}
+
+void scr_end(void)
+{
+    if (col >= COLS)
+        scr_newline();
+
+    moveCursor(col, row);
+}
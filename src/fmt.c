@@ -0,0 +1,137 @@
+#include "ai-sam.h"
+#include "config.h"  // PROXY_API_URL
+
+// Output goes either to the console (buf == NULL) or into a buffer
+typedef struct
+{
+    char *buf;
+    uint16_t size;
+    uint16_t len;
+} fmt_sink;
+
+static void fmt_putc(fmt_sink *sink, char c)
+{
+    if (!sink->buf)
+    {
+        out_char(c);
+    }
+    else if (sink->len + 1 < sink->size)
+    {
+        sink->buf[sink->len++] = c;
+    }
+}
+
+static void fmt_puts(fmt_sink *sink, const char *s)
+{
+    while (*s)
+    {
+        fmt_putc(sink, *s++);
+    }
+}
+
+static void fmt_putu(fmt_sink *sink, unsigned int n)
+{
+    char digits[6];
+    uint8_t i = 0;
+
+    do
+    {
+        digits[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+
+    while (i)
+    {
+        fmt_putc(sink, digits[--i]);
+    }
+}
+
+static void fmt_core(fmt_sink *sink, const char *fmt, va_list ap)
+{
+    int d;
+
+    while (*fmt)
+    {
+        if (*fmt != '%')
+        {
+            fmt_putc(sink, *fmt++);
+            continue;
+        }
+
+        switch (*++fmt)
+        {
+        case 's':
+            fmt_puts(sink, va_arg(ap, const char *));
+            break;
+        case 'd':
+            d = va_arg(ap, int);
+            if (d < 0)
+            {
+                fmt_putc(sink, '-');
+                d = -d;
+            }
+            fmt_putu(sink, (unsigned int)d);
+            break;
+        case 'u':
+            fmt_putu(sink, va_arg(ap, unsigned int));
+            break;
+        case '%':
+            fmt_putc(sink, '%');
+            break;
+        case '\0':
+            return;
+        }
+        fmt++;
+    }
+}
+
+void out_str(const char *s)
+{
+    while (*s)
+    {
+        out_char(*s++);
+    }
+    out_flush();
+}
+
+void out_fmt(const char *fmt, ...)
+{
+    fmt_sink sink = { NULL, 0, 0 };
+    va_list ap;
+
+    va_start(ap, fmt);
+    fmt_core(&sink, fmt, ap);
+    va_end(ap);
+    out_flush();
+}
+
+// Like snprintf: always NUL terminates, returns the length written
+uint16_t str_fmt(char *buf, uint16_t size, const char *fmt, ...)
+{
+    fmt_sink sink;
+    va_list ap;
+
+    sink.buf = buf;
+    sink.size = size;
+    sink.len = 0;
+
+    va_start(ap, fmt);
+    fmt_core(&sink, fmt, ap);
+    va_end(ap);
+
+    buf[sink.len] = '\0';
+    return sink.len;
+}
+
+void url_build(const char *endpoint)
+{
+    str_fmt(DEVICESPEC, DEVICESPEC_SIZE, "N1:%s%s", PROXY_API_URL, endpoint);
+}
+
+void url_add_param(const char *name, const char *value)
+{
+    uint16_t len = strlen(DEVICESPEC);
+
+    str_fmt(DEVICESPEC + len, DEVICESPEC_SIZE - len, "%s%s=%s",
+            strchr(DEVICESPEC, '?') ? "&" : "?", name, value);
+}
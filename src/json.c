@@ -0,0 +1,127 @@
+#include <string.h>
+#include "json.h"
+
+// Room kept back for the closing quote, the closing brace and the NUL
+#define JSON_RESERVE 3
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// Append n bytes if they fit in front of the reserve
+static bool json_put(json_writer *w, const char *s, uint8_t n)
+{
+    if (w->truncated || w->len + n > w->size - JSON_RESERVE)
+    {
+        w->truncated = true;
+        return false;
+    }
+    while (n--)
+    {
+        w->buf[w->len++] = *s++;
+    }
+    return true;
+}
+
+// Append an escaped string value. The opening quote must already be
+// written; the closing quote is always written from the reserve.
+static void json_put_value(json_writer *w, const char *s)
+{
+    char esc[6];
+    unsigned char c;
+
+    while ((c = (unsigned char)*s++) != '\0')
+    {
+        if (c == '"' || c == '\\')
+        {
+            esc[0] = '\\';
+            esc[1] = c;
+            if (!json_put(w, esc, 2)) break;
+        }
+        else if (c >= 0x20 && c < 0x80)
+        {
+            esc[0] = c;
+            if (!json_put(w, esc, 1)) break;
+        }
+        else
+        {
+            // Control characters and 8-bit machine characters
+            esc[0] = '\\';
+            switch (c)
+            {
+            // Byte values, not '\n' and friends, which cc65 maps to
+            // ATASCII codes on the Atari
+            case 0x08: esc[1] = 'b'; break;
+            case 0x09: esc[1] = 't'; break;
+            case 0x0A: esc[1] = 'n'; break;
+            case 0x0C: esc[1] = 'f'; break;
+            case 0x0D: esc[1] = 'r'; break;
+#ifdef BUILD_ATARI
+            case 0x9B: esc[1] = 'n'; break; // ATASCII end of line
+#endif
+            default:   esc[1] = 0;   break;
+            }
+            if (esc[1])
+            {
+                if (!json_put(w, esc, 2)) break;
+            }
+            else
+            {
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = hex_digits[c >> 4];
+                esc[5] = hex_digits[c & 0x0F];
+                if (!json_put(w, esc, 6)) break;
+            }
+        }
+    }
+    // Always fits: one of the reserved bytes
+    w->buf[w->len++] = '"';
+}
+
+void json_begin(json_writer *w, char *buf, uint16_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->first = true;
+    w->truncated = false;
+    w->buf[w->len++] = '{';
+}
+
+// Keys are plain ASCII and never escaped. A key is only written if it fits
+// together with the start of its value, so no key is left without a value.
+void json_add_string(json_writer *w, const char *key, const char *value)
+{
+    uint16_t keylen;
+
+    if (w->truncated)
+        return;
+
+    keylen = strlen(key);
+    if (w->len + keylen + 5 > w->size - JSON_RESERVE)
+    {
+        w->truncated = true;
+        return;
+    }
+
+    if (!w->first)
+        w->buf[w->len++] = ',';
+    w->first = false;
+
+    w->buf[w->len++] = '"';
+    memcpy(w->buf + w->len, key, keylen);
+    w->len += keylen;
+    w->buf[w->len++] = '"';
+    w->buf[w->len++] = ':';
+    w->buf[w->len++] = '"';
+
+    json_put_value(w, value);
+}
+
+// Close the object. Returns false if anything had to be left out.
+bool json_end(json_writer *w)
+{
+    w->buf[w->len++] = '}';
+    w->buf[w->len] = '\0';
+    return !w->truncated;
+}
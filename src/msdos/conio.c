@@ -1,18 +1,55 @@
 #include <i86.h>
 #include <dos.h>
+#include <conio.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 extern int getch(void);
-extern int putch(int);
 
 int screen_width = 80;
 int screen_height = 25;
 
+// Text is written straight to video memory. The cursor position is kept in
+// the BIOS data area like the BIOS does itself, so DOS and BIOS output still
+// lands in the right place, but the CRTC (the blinking hardware cursor) is
+// only updated by con_sync() when an output batch ends or input is read.
+#define ATTR_NORMAL 0x07
+#define BLANK       ((ATTR_NORMAL << 8) | ' ')
+
+static uint16_t far *vram;
+static uint8_t far *cursor_pos;  // column, row of the active page (BDA)
+
+static void vram_fill(uint16_t far *p, uint16_t count)
+{
+    while (count--)
+        *p++ = BLANK;
+}
+
+static void scroll_up(void)
+{
+    uint16_t row_cells = (uint16_t)screen_width;
+    uint16_t cells = row_cells * (uint16_t)(screen_height - 1);
+
+    _fmemmove(vram, vram + row_cells, cells * 2);
+    vram_fill(vram + cells, row_cells);
+}
+
+static void next_line(void)
+{
+    cursor_pos[0] = 0;
+    if (cursor_pos[1] < screen_height - 1)
+        cursor_pos[1]++;
+    else
+        scroll_up();
+}
+
 void msdos_init_screen(void)
 {
     union REGS r;
     uint8_t far *bda_rows;
+    uint8_t page;
+    uint16_t page_ofs;
 
     r.h.ah = 0x0F;
     int86(0x10, &r, &r);
@@ -26,12 +63,93 @@ void msdos_init_screen(void)
     else
         screen_height = 25;
 
+    // Mode 7 is the monochrome adapter, everything else is colour text
+    page = r.h.bh;
+    page_ofs = *(uint16_t far *)MK_FP(0x0040, 0x004E);
+    vram = (uint16_t far *)MK_FP(r.h.al == 7 ? 0xB000 : 0xB800, page_ofs);
+    cursor_pos = (uint8_t far *)MK_FP(0x0040, 0x0050 + page * 2);
+
     clrscr();
 }
 
+// Move the hardware cursor to the tracked position
+void con_sync(void)
+{
+    uint16_t crtc = *(uint16_t far *)MK_FP(0x0040, 0x0063);
+    uint16_t ofs = (uint16_t)cursor_pos[1] * screen_width + cursor_pos[0];
+
+    ofs += *(uint16_t far *)MK_FP(0x0040, 0x004E) / 2;
+    outp(crtc, 0x0E);
+    outp(crtc + 1, ofs >> 8);
+    outp(crtc, 0x0F);
+    outp(crtc + 1, ofs & 0xFF);
+}
+
+void con_putc(char c)
+{
+    switch (c)
+    {
+    case '\n':
+        next_line();
+        break;
+    case '\r':
+        cursor_pos[0] = 0;
+        break;
+    case '\b':
+        if (cursor_pos[0])
+            cursor_pos[0]--;
+        break;
+    case '\t':
+        do
+            con_putc(' ');
+        while (cursor_pos[0] & 7);
+        break;
+    case '\a':
+        break;
+    default:
+        if (cursor_pos[0] >= screen_width)
+            next_line();
+        vram[cursor_pos[1] * screen_width + cursor_pos[0]++] =
+            (ATTR_NORMAL << 8) | (uint8_t)c;
+        break;
+    }
+}
+
+// Write a run of printable characters on the current row at once
+void con_write(const char *s, uint16_t len)
+{
+    uint16_t far *p;
+    uint8_t x;
+
+    while (len)
+    {
+        if ((uint8_t)*s < ' ')
+        {
+            con_putc(*s++);
+            len--;
+            continue;
+        }
+
+        if (cursor_pos[0] >= screen_width)
+            next_line();
+        x = cursor_pos[0];
+        p = vram + cursor_pos[1] * screen_width + x;
+        while (len && x < screen_width && (uint8_t)*s >= ' ')
+        {
+            *p++ = (ATTR_NORMAL << 8) | (uint8_t)*s++;
+            x++;
+            len--;
+        }
+        cursor_pos[0] = x;
+    }
+}
+
 char cgetc(void)
 {
-    int c = getch();
+    int c;
+
+    con_sync();
+    c = getch();
     if (c == 0 || c == 0xE0)
         (void)getch();
     return (char)c;
@@ -39,51 +157,31 @@ char cgetc(void)
 
 void cputc(char c)
 {
-    putch((unsigned char)c);
+    con_putc(c);
 }
 
 void clrscr(void)
 {
-    union REGS r;
-    r.h.ah = 0x06;
-    r.h.al = 0x00;
-    r.h.bh = 0x07;
-    r.h.ch = 0; r.h.cl = 0;
-    r.h.dh = (uint8_t)(screen_height - 1);
-    r.h.dl = (uint8_t)(screen_width  - 1);
-    int86(0x10, &r, &r);
-    r.h.ah = 0x02;
-    r.h.bh = 0x00;
-    r.h.dh = 0; r.h.dl = 0;
-    int86(0x10, &r, &r);
+    vram_fill(vram, (uint16_t)screen_width * screen_height);
+    cursor_pos[0] = 0;
+    cursor_pos[1] = 0;
+    con_sync();
 }
 
 void gotoxy(int x, int y)
 {
-    union REGS r;
     if (x < 1) x = 1;
     if (y < 1) y = 1;
-    r.h.ah = 0x02;
-    r.h.bh = 0x00;
-    r.h.dh = (uint8_t)(y - 1);
-    r.h.dl = (uint8_t)(x - 1);
-    int86(0x10, &r, &r);
+    cursor_pos[0] = (uint8_t)(x - 1);
+    cursor_pos[1] = (uint8_t)(y - 1);
 }
 
 int wherex(void)
 {
-    union REGS r;
-    r.h.ah = 0x03;
-    r.h.bh = 0x00;
-    int86(0x10, &r, &r);
-    return (int)r.h.dl + 1;
+    return (int)cursor_pos[0] + 1;
 }
 
 int wherey(void)
 {
-    union REGS r;
-    r.h.ah = 0x03;
-    r.h.bh = 0x00;
-    int86(0x10, &r, &r);
-    return (int)r.h.dh + 1;
+    return (int)cursor_pos[1] + 1;
 }
@@ -0,0 +1,24 @@
+#include <ai-sam.h>
+#include <screen.h>
+
+// Replies go to video memory through the console backend in conio.c,
+// with the hardware cursor synced once the page is done.
+
+void scr_begin(void)
+{
+}
+
+void scr_write(const char *s, uint16_t len)
+{
+    con_write(s, len);
+}
+
+void scr_newline(void)
+{
+    con_putc('\n');
+}
+
+void scr_end(void)
+{
+    con_sync();
+}
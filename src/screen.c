@@ -0,0 +1,29 @@
+#include "ai-sam.h"
+#include "speech.h"  // NEWLINE
+#include "screen.h"
+
+// Console fallback for platforms without a direct renderer
+#ifndef SCREEN_DIRECT
+
+void scr_begin(void)
+{
+}
+
+void scr_write(const char *s, uint16_t len)
+{
+    while (len--)
+    {
+        putchar(*s++);
+    }
+}
+
+void scr_newline(void)
+{
+    putchar(NEWLINE);
+}
+
+void scr_end(void)
+{
+}
+
+#endif // SCREEN_DIRECT
@@ -0,0 +1,17 @@
+// Build host tool: prints the buffer arena layout for the platform it was
+// compiled for (-DBUILD_<PLATFORM>, plus -D_CMOC_VERSION_ for CMOC builds).
+// Run from the top-level Makefile after each link.
+
+#include <stdio.h>
+#include "arena.h"
+
+int main(void)
+{
+    printf("Buffer arena: %u bytes (request %u, reply %u, shared %u)\n",
+           (unsigned)ARENA_SIZE, (unsigned)ARENA_REQUEST_SIZE,
+           (unsigned)ARENA_REPLY_SIZE, (unsigned)ARENA_SHARED_SIZE);
+    printf("Separate buffers would take %u bytes, BSS saved: %u bytes\n",
+           (unsigned)ARENA_UNSHARED_SIZE,
+           (unsigned)(ARENA_UNSHARED_SIZE - ARENA_SIZE));
+    return 0;
+}